@@ -0,0 +1,50 @@
+// 2026/10/19
+
+/*!
+	@file	  array_view.hpp
+	@brief	  <Tv>
+
+	Äւ̓ǂݎpr[(LȂ)
+*/
+
+#ifndef ARRAY_VIEW_HPP_
+#define ARRAY_VIEW_HPP_
+
+#include <vector>
+#include <cassert>
+
+template <class T>
+class ArrayView {
+public:
+    typedef T           value_type;
+    typedef const T*    iterator;
+    typedef const T*    const_iterator;
+
+public:
+    ArrayView() : begin_(nullptr), end_(nullptr) {}
+    ArrayView(const T* p, size_t n) : begin_(p), end_(p + n) {}
+    ArrayView(const T* b, const T* e) : begin_(b), end_(e) {}
+    ArrayView(const std::vector<T>& v)
+        : begin_(v.empty() ? nullptr : &v[0]),
+          end_(v.empty() ? nullptr : &v[0] + v.size()) {}
+
+    const T* begin() const { return begin_; }
+    const T* end() const { return end_; }
+    const T* data() const { return begin_; }
+    size_t size() const { return size_t(end_ - begin_); }
+    bool empty() const { return begin_ == end_; }
+
+    const T& operator[](size_t i) const {
+        assert(i < size());
+        return begin_[i];
+    }
+    const T& front() const { return *begin_; }
+    const T& back() const { return *(end_ - 1); }
+
+private:
+    const T* begin_;
+    const T* end_;
+
+};
+
+#endif // ARRAY_VIEW_HPP_
@@ -0,0 +1,548 @@
+// 2026/10/19
+
+#include "bench.hpp"
+#include "terrain.hpp"
+#include "gci.hpp"
+#include "water.hpp"
+#include "board.hpp"
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <map>
+#include <tuple>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+#include <boost/random.hpp>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double milliseconds(Clock::time_point t0, Clock::time_point t1) {
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+void collect_all_segments(
+    const gci::Document& doc, std::vector<TerrainSegment>& segments) {
+    std::vector<int> cells(doc.cell_count());
+    for (size_t i = 0 ; i < cells.size() ; i++) { cells[i] = int(i); }
+    collect_terrain_segments(doc, ArrayView<int>(cells), segments);
+}
+
+// _S܂TerrainMap
+TerrainMap* make_terrain_map(const gci::Document& doc) {
+    float minx = FLT_MAX, miny = FLT_MAX, maxx = -FLT_MAX, maxy = -FLT_MAX;
+    for (const D3DXVECTOR2& p: doc.vertex_array()) {
+        minx = (std::min)(minx, p.x);
+        miny = (std::min)(miny, p.y);
+        maxx = (std::max)(maxx, p.x);
+        maxy = (std::max)(maxy, p.y);
+    }
+    return new TerrainMap(minx - 1.0f, miny - 1.0f, maxx + 1.0f, maxy + 1.0f);
+}
+
+void build_map(TerrainMap& tm, std::vector<TerrainSegment>& segments) {
+    build_terrain_map(
+        tm, segments, terrain_depth_bound(segments.size()),
+        [&tm](size_t, const TerrainSegment& ts) {
+            tm.add_segment(
+                tm.make_point(ts.p0.x, ts.p0.y),
+                tm.make_point(ts.p1.x, ts.p1.y),
+                true, ts.sp);
+        });
+}
+
+// terrain_map: TrapezoidalMap̍\zƔj
+// (m[hMonotonicArenaAj̓ubN̂Ă邾)
+bool bench_terrain_map(const gci::Document& doc, std::ostream& os) {
+    const int REPEAT = 5;
+
+    std::vector<TerrainSegment> segments;
+    collect_all_segments(doc, segments);
+
+    double build = 0;
+    double destroy = 0;
+    int max_depth = 0;
+    for (int i = 0 ; i < REPEAT ; i++) {
+        Clock::time_point t0 = Clock::now();
+        std::unique_ptr<TerrainMap> tm(make_terrain_map(doc));
+        build_map(*tm, segments);
+        max_depth = tm->depth_stats().max_depth;
+        Clock::time_point t1 = Clock::now();
+        tm.reset();
+        Clock::time_point t2 = Clock::now();
+        build += milliseconds(t0, t1);
+        destroy += milliseconds(t1, t2);
+    }
+
+    os << "segments " << segments.size()
+       << ", depth max " << max_depth << "\n"
+       << "build " << build / REPEAT << " ms, "
+       << "destroy " << destroy / REPEAT << " ms\n";
+    return true;
+}
+
+// ȑOstd::mapɂd(p)
+void collect_terrain_segments_with_map(
+    const gci::Document& doc, std::vector<TerrainSegment>& segments) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+
+    std::map<std::pair<int, int>, TerrainSegmentProperty> edges;
+    for (size_t i = 0 ; i < doc.cell_count() ; i++) {
+        ArrayView<int> v = doc.cell_vertex_indices(i);
+        for (size_t j = 0 ; j < v.size() ; j++) {
+            int index0 = v[j];
+            int index1 = v[(j+1) % v.size()];
+
+            const D3DXVECTOR2& p0 = vertices[index0];
+            const D3DXVECTOR2& p1 = vertices[index1];
+            bool invert = !(p0.x < p1.x || (p0.x == p1.x && p0.y < p1.y));
+
+            if (index1 < index0) { std::swap(index0, index1); }
+
+            TerrainSegmentProperty none;
+            none.upper_cell_index = -1;
+            none.lower_cell_index = -1;
+            TerrainSegmentProperty& sp = edges.insert(
+                std::make_pair(std::make_pair(index0, index1), none))
+                .first->second;
+            if (invert) {
+                sp.upper_cell_index = int(i);
+            } else {
+                sp.lower_cell_index = int(i);
+            }
+        }
+    }
+
+    segments.clear();
+    for (const auto& e: edges) {
+        TerrainSegment ts;
+        ts.p0 = vertices[e.first.first];
+        ts.p1 = vertices[e.first.second];
+        ts.sp = e.second;
+        segments.push_back(ts);
+    }
+}
+
+// яɂȂr
+bool same_segments(
+    const std::vector<TerrainSegment>& a,
+    const std::vector<TerrainSegment>& b) {
+    typedef std::tuple<float, float, float, float, int, int> Key;
+    auto keys = [](const std::vector<TerrainSegment>& segments) {
+        std::vector<Key> k;
+        for (const TerrainSegment& ts: segments) {
+            k.push_back(
+                Key(ts.p0.x, ts.p0.y, ts.p1.x, ts.p1.y,
+                    ts.sp.upper_cell_index, ts.sp.lower_cell_index));
+        }
+        std::sort(k.begin(), k.end());
+        return k;
+    };
+    return keys(a) == keys(b);
+}
+
+// edges: ӂ̏d(radix sort)std::mapłƔׂ
+bool bench_edges(const gci::Document& doc, std::ostream& os) {
+    const int REPEAT = 5;
+
+    std::vector<TerrainSegment> sorted;
+    std::vector<TerrainSegment> mapped;
+    double sort_time = 0;
+    double map_time = 0;
+    for (int i = 0 ; i < REPEAT ; i++) {
+        Clock::time_point t0 = Clock::now();
+        collect_all_segments(doc, sorted);
+        Clock::time_point t1 = Clock::now();
+        collect_terrain_segments_with_map(doc, mapped);
+        Clock::time_point t2 = Clock::now();
+        sort_time += milliseconds(t0, t1);
+        map_time += milliseconds(t1, t2);
+    }
+
+    bool same = same_segments(sorted, mapped);
+    os << "segments " << sorted.size() << " / " << mapped.size()
+       << (same ? ", same\n" : ", DIFFERENT\n")
+       << "radix sort " << sort_time / REPEAT << " ms, "
+       << "std::map " << map_time / REPEAT << " ms\n";
+    return same;
+}
+
+// finď(rp)
+struct FindResult {
+    bool    found;
+    float   corners[8];
+    int     score;
+    int     cells[4];
+
+    bool operator==(const FindResult& r) const {
+        if (found != r.found) { return false; }
+        if (!found) { return true; }
+        return
+            std::equal(corners, corners + 8, r.corners) &&
+            score == r.score &&
+            std::equal(cells, cells + 4, r.cells);
+    }
+};
+
+// MapTerrainMachineTerrainMap
+template <class Map>
+double find_all(
+    const Map&                                  tmm,
+    const std::vector<TerrainMachine::Point>&   queries,
+    std::vector<FindResult>&                    results) {
+    results.resize(queries.size());
+    Clock::time_point t0 = Clock::now();
+    for (size_t i = 0 ; i < queries.size() ; i++) {
+        TerrainMachine::Point p[4];
+        TerrainSegmentProperty tsp, bsp;
+        FindResult& r = results[i];
+        r.found = tmm.find(
+            queries[i], p[0], p[1], p[2], p[3], r.score, tsp, bsp);
+        for (int j = 0 ; j < 4 ; j++) {
+            r.corners[j*2+0] = p[j].x();
+            r.corners[j*2+1] = p[j].y();
+        }
+        r.cells[0] = tsp.upper_cell_index;
+        r.cells[1] = tsp.lower_cell_index;
+        r.cells[2] = bsp.upper_cell_index;
+        r.cells[3] = bsp.lower_cell_index;
+    }
+    return milliseconds(t0, Clock::now());
+}
+
+// grid: TerrainMachine::findObhȂ/GRID_AUTOŔׂ
+// iq(X^)ƃ_2ʂ̃NGŁAʂ͓łȂ΂ȂȂ
+bool bench_grid(const gci::Document& doc, std::ostream& os) {
+    const int RASTER_SIZE   = 512;
+    const int RANDOM_COUNT  = RASTER_SIZE * RASTER_SIZE;
+
+    std::vector<TerrainSegment> segments;
+    collect_all_segments(doc, segments);
+    std::unique_ptr<TerrainMap> tm(make_terrain_map(doc));
+    build_map(*tm, segments);
+    TerrainMachine tmm(*tm);
+
+    float minx = tm->bbmin().x();
+    float miny = tm->bbmin().y();
+    float maxx = tm->bbmax().x();
+    float maxy = tm->bbmax().y();
+
+    std::vector<TerrainMachine::Point> raster;
+    for (int y = 0 ; y < RASTER_SIZE ; y++) {
+        for (int x = 0 ; x < RASTER_SIZE ; x++) {
+            raster.push_back(
+                tm->make_point(
+                    minx + (maxx - minx) * (x + 0.5f) / RASTER_SIZE,
+                    miny + (maxy - miny) * (y + 0.5f) / RASTER_SIZE));
+        }
+    }
+
+    boost::mt19937 gen(0);
+    boost::uniform_real<float> ux(minx, maxx);
+    boost::uniform_real<float> uy(miny, maxy);
+    std::vector<TerrainMachine::Point> random;
+    for (int i = 0 ; i < RANDOM_COUNT ; i++) {
+        float x = ux(gen);
+        random.push_back(tm->make_point(x, uy(gen)));
+    }
+
+    bool same = true;
+    const std::vector<TerrainMachine::Point>* queries[] = { &raster, &random };
+    const char* names[] = { "raster", "random" };
+    for (int i = 0 ; i < 2 ; i++) {
+        std::vector<FindResult> plain, grid;
+        tmm.build_grid(0, 0);
+        double plain_time = find_all(tmm, *queries[i], plain);
+        tmm.build_grid(TerrainMachine::GRID_AUTO, TerrainMachine::GRID_AUTO);
+        double grid_time = find_all(tmm, *queries[i], grid);
+
+        bool s = plain == grid;
+        same = same && s;
+        os << names[i] << " " << queries[i]->size() << " queries: "
+           << "no grid " << plain_time << " ms, "
+           << "grid " << grid_time << " ms"
+           << (s ? ", same\n" : ", DIFFERENT\n");
+    }
+    return same;
+}
+
+// ҏWboard̃R[hA蒼R[hTrapezoidalMap::findɔׂ
+// HNG̐
+size_t count_patch_mismatches(
+    const Board&                                board,
+    const std::vector<TerrainMachine::Point>&   queries) {
+    const TerrainMap& tm = board.terrain_map();
+    std::vector<char> code;
+    tm.compile_detached(code);
+    TerrainMachine rebuilt;
+    rebuilt.attach(&code[0], code.size());
+
+    std::vector<FindResult> a, b, c;
+    find_all(board.terrain_machine(), queries, a);
+    find_all(rebuilt, queries, b);
+    find_all(tm, queries, c);
+
+    size_t n = 0;
+    for (size_t i = 0 ; i < queries.size() ; i++) {
+        if (!(a[i] == b[i]) || !(a[i] == c[i])) { n++; }
+    }
+    return n;
+}
+
+// n`̂ȂꏊɕǂׂĈꕔ󂵁ÃZ
+// iKƂɍ𓖂ĂR[h𒲂ׂ
+bool edit_and_check(Board& board, std::ostream& os) {
+    const int   RASTER_SIZE = 768;
+    const int   MAX_WALLS   = 160;  // cave.gcił͓rŃR[h蒼
+
+    const TerrainMap& tm = board.terrain_map();
+    std::vector<TerrainMachine::Point> queries;
+    float minx = tm.bbmin().x();
+    float miny = tm.bbmin().y();
+    float maxx = tm.bbmax().x();
+    float maxy = tm.bbmax().y();
+    for (int y = 0 ; y < RASTER_SIZE ; y++) {
+        for (int x = 0 ; x < RASTER_SIZE ; x++) {
+            queries.push_back(
+                tm.make_point(
+                    minx + (maxx - minx) * (x + 0.5f) / RASTER_SIZE,
+                    miny + (maxy - miny) * (y + 0.5f) / RASTER_SIZE));
+        }
+    }
+
+    bool ok = true;
+    auto check = [&](const char* phase) {
+        size_t n = count_patch_mismatches(board, queries);
+        os << "  " << phase << ": code " << board.terrain_machine().image_size()
+           << " bytes, " << n << " mismatches\n";
+        ok = ok && n == 0;
+    };
+
+    // ǂ̎ɒn`Ȃꏊ
+    IConstraint& constraint = board.constraint();
+    auto is_free = [&constraint](float x, float y) {
+        for (float dy = -6 ; dy <= 6 ; dy += 1) {
+            for (float dx = -10 ; dx <= 10 ; dx += 1) {
+                Vector v(x + dx, y + dy);
+                if (!(constraint.apply(v) == v)) { return false; }
+            }
+        }
+        return true;
+    };
+
+    // c񂾃R[h蒼ƃTCY
+    std::vector<int> walls;
+    int rebuilds = 0;
+    for (float y = 20 ; y < 500 && int(walls.size()) < MAX_WALLS ; y += 13) {
+        for (float x = 20 ; x < 500 && int(walls.size()) < MAX_WALLS ;
+             x += 17) {
+            if (!is_free(x, y)) { continue; }
+            size_t size = board.terrain_machine().image_size();
+            int cell = board.add_wall(
+                Vector(x - 6, y), Vector(x + 6, y + 2), 3.0f);
+            if (cell < 0) { continue; }
+            walls.push_back(cell);
+            if (walls.size() == 1) { check("1 wall"); }
+            if (board.terrain_machine().image_size() < size &&
+                rebuilds++ == 0) {
+                check("rebuilt");
+            }
+        }
+    }
+    os << "  walls " << walls.size() << ", rebuilt " << rebuilds << "\n";
+    if (walls.empty()) { return false; }
+    check("all walls");
+
+    for (size_t i = 0 ; i < walls.size() ; i += 2) {
+        board.destroy_cell(walls[i]);
+        board.destroy_cell(walls[i] + 1);
+    }
+    check("half walls destroyed");
+
+    for (int cell = 0 ; cell < walls[0] ; cell += 37) {
+        board.destroy_cell(cell);
+    }
+    check("terrain cells destroyed");
+    return ok;
+}
+
+// patch: n`̕ҏWō𓖂ĂR[h(TrapezoidalMapMachine::patch)
+// 蒼R[h(init)TrapezoidalMap::findɓ˂킹
+// RpCċNꍇƃLbVNꍇ̗
+// (n`BoardƓTERRAIN_FILENAMETERRAIN_BINARY_FILENAME)
+bool bench_patch(const gci::Document&, std::ostream& os) {
+    // 1ڂ̓LbVȂŃRpCÂƂ̂2ڂɎg
+    std::remove(TERRAIN_CACHE_FILENAME);
+
+    bool ok = true;
+    for (int pass = 0 ; pass < 2 ; pass++) {
+        Board board;
+        board.setup();
+        bool cached = board.uses_terrain_cache();
+        os << (cached ? "cache hit\n" : "fresh compile\n");
+        if (cached != (pass == 1)) {
+            os << "  unexpected cache state\n";
+            ok = false;
+            continue;
+        }
+        ok = edit_and_check(board, os) && ok;
+    }
+    return ok;
+}
+
+// d͂balance͂RpCɊOȂWaterTraits
+struct FullWaterTraits : public WaterTraits {
+    enum { USE_GRAVITY = 1, USE_BALANCE_PRESSURE = 1 };
+};
+
+// targetֈ̑Ōq
+class BenchPartawn : public TrivialPartawn {
+public:
+    BenchPartawn(TeamTag team_tag, const Vector& target)
+        : TrivialPartawn(team_tag), target_(target) {}
+
+    Vector constraint_velocity(const Vector& v) { return v; }
+    Vector move(const Vector& p) {
+        const float SPEED = 50.0f;
+        Vector d = target_ - p;
+        float l = D3DXVec2Length(&d);
+        return l < 1.0f ? Vector(0, 0) : d * (SPEED / l);
+    }
+    void update(float) {}
+
+private:
+    Vector target_;
+};
+
+// WaterƓp[^stepsupdate
+template <class Traits>
+double run_sph(
+    std::vector<BenchPartawn>&  loads,
+    const std::vector<Vector>&  origins,
+    int                         steps,
+    std::vector<Vector>&        positions) {
+    sph::sph<Traits> s;
+    s.initialize(
+        SEARCH_RADIUS,
+        VISCOSITY,
+        DUMPING,
+        Vector(0, GRAVITY),
+        IDEAL_DENSITY,
+        PRESSURE_BALANCE_COEFFICIENT,
+        PRESSURE_REPULSIVE_COEFFICIENT);
+    s.set_outputs(0);
+    for (size_t i = 0 ; i < origins.size() ; i++) {
+        s.add_particle(origins[i], MASS, &loads[i]);
+    }
+
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0 ; i < steps ; i++) { s.update(DT); }
+    Clock::time_point t1 = Clock::now();
+
+    positions.clear();
+    for (const Vector& v: s.positions()) { positions.push_back(v); }
+    return milliseconds(t0, t1);
+}
+
+// sph: sph::updateAd͂balance͂OWaterTraits
+// OȂ̂ƂŔׂ
+// 2`[̗q̉ԂAW͂ǂ0Ȃ̂ňʒu͓͂
+bool bench_sph(const gci::Document&, std::ostream& os) {
+    const int   SIDES[]     = { 64, 128 };  // 1ӂ̗q
+    const int   STEPS       = 100;
+
+    bool same = true;
+    for (int side: SIDES) {
+        std::vector<Vector> origins;
+        std::vector<BenchPartawn> loads;
+        float span = side * INITIAL_DISTANCE;
+        for (int t = 0 ; t < 2 ; t++) {
+            TeamTag team = t == 0 ? TeamTag::Alpha : TeamTag::Beta;
+            // 2qĕׁẢ̌֐i܂
+            float x0 = t == 0 ? 0 : span + INITIAL_DISTANCE * 2;
+            Vector target(t == 0 ? span * 3 : -span, span * 0.5f);
+            for (int y = 0 ; y < side ; y++) {
+                for (int x = 0 ; x < side ; x++) {
+                    origins.push_back(
+                        Vector(x0 + x * INITIAL_DISTANCE,
+                               y * INITIAL_DISTANCE));
+                    loads.push_back(BenchPartawn(team, target));
+                }
+            }
+        }
+
+        std::vector<Vector> a, b;
+        double water_time = run_sph<WaterTraits>(loads, origins, STEPS, a);
+        double full_time = run_sph<FullWaterTraits>(loads, origins, STEPS, b);
+
+        bool s = a.size() == b.size();
+        for (size_t i = 0 ; s && i < a.size() ; i++) {
+            s = a[i].x == b[i].x && a[i].y == b[i].y;
+        }
+        same = same && s;
+        os << origins.size() << " particles: "
+           << "WaterTraits " << water_time / STEPS << " ms, "
+           << "gravity+balance " << full_time / STEPS << " ms per update"
+           << (s ? ", same\n" : ", DIFFERENT\n");
+    }
+    return same;
+}
+
+// water: q̒_XbhɕĂʂςȂ
+// (.gci͎gȂ)
+bool bench_water(const gci::Document&, std::ostream& os) {
+    // Xbh8ł邾̗q
+    const size_t PARTICLE_COUNT = 8192 * 8 + 123;
+
+    Clock::time_point t0 = Clock::now();
+    bool same = check_water_vertices(PARTICLE_COUNT);
+    Clock::time_point t1 = Clock::now();
+
+    os << "particles " << PARTICLE_COUNT
+       << (same ? ", same" : ", DIFFERENT")
+       << ", " << milliseconds(t0, t1) << " ms\n";
+    return same;
+}
+
+struct Bench {
+    const char* name;
+    bool        document;   // .gciǂނ
+    bool        (*run)(const gci::Document&, std::ostream&);
+};
+
+const Bench BENCHES[] = {
+    { "terrain_map", true,  bench_terrain_map },
+    { "edges",       true,  bench_edges },
+    { "grid",        true,  bench_grid },
+    { "water",       false, bench_water },
+    { "patch",       false, bench_patch },
+    { "sph",         false, bench_sph },
+};
+
+}
+
+//****************************************************************
+// run_bench
+int run_bench(
+    const char* name,
+    const char* output_filename,
+    const char* gci_filename) {
+    const Bench* bench = nullptr;
+    for (const Bench& b: BENCHES) {
+        if (strcmp(b.name, name) == 0) { bench = &b; }
+    }
+    if (!bench) { return 1; }
+
+    gci::Document doc;
+    if (bench->document && !gci::read_gci(gci_filename, doc)) { return 1; }
+
+    std::ofstream os(output_filename);
+    if (!os) { return 1; }
+    os << name;
+    if (bench->document) { os << ": " << gci_filename; }
+    os << "\n";
+    return bench->run(doc, os) ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+// 2026/10/19
+
+/*!
+	@file	  bench.hpp
+	@brief	  <Tv>
+
+	n`E܂̌vƌEBhEoɑ点
+	pasta.exe -bench <name> <o̓t@C> [.gci]
+*/
+
+#ifndef BENCH_HPP_
+#define BENCH_HPP_
+
+// ʂoutput_filenameɏ
+// mȂnameA.gciǂ߂ȂAɎsƂ1Ԃ
+int run_bench(
+    const char* name,
+    const char* output_filename,
+    const char* gci_filename);
+
+#endif // BENCH_HPP_
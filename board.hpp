@@ -11,6 +11,8 @@
 #define BOARD_HPP_
 
 #include "trapezoidal_map.hpp"
+#include "terrain.hpp"
+#include "tiled_terrain.hpp"
 #include "water.hpp"
 #include "gci.hpp"
 #include "pathview.hpp"
@@ -20,20 +22,56 @@
 #include "station.hpp"
 #include "basecamp.hpp"
 #include "team.hpp"
+#include "terrain_cache.hpp"
+#include "array_view.hpp"
+#include "performance_counter.hpp"
 #include <memory>
+#include <future>
+#include <atomic>
+#include <chrono>
 
 const int HCOUNT				   = 10;
 const int VCOUNT				   = 10;
 
+const char* const TERRAIN_FILENAME        = "data/cave.gci";
+const char* const TERRAIN_BINARY_FILENAME = "data/cave.gcb";
+const char* const TERRAIN_CACHE_FILENAME  = "data/cave.gci.cache";
+
+// ꂪ΃^C̑傫}bvƂĎg
+const char* const TERRAIN_WORLD_FILENAME  = "data/world.gcb";
+
 class Board {
 public:
     Board()
-        : tm_(0, 0, 1024, 1024), constraint_(terrain_, tmm_), ready_(false) {
+        : tm_(0, 0, 1024, 1024), constraint_(cell_sites_, tmm_),
+          ready_(false), terrain_editable_(false), compiled_code_size_(0),
+          color_index_(0), terrain_primitives_version_(0),
+          load_progress_(0) {
     }
 
-    void setup() {
-        read_gci("data/cave.gci", terrain_);
-        compile_terrain(terrain());
+    // n`̓ǂݍ(.gcỉ́En`RpCEPrimitive)
+    // [J[XbhŎn߂
+    // Ipoll_setup`[ready_𗧂Ă
+    void start_setup() {
+        if (loader_.valid() || ready_) { return; }
+        load_progress_ = 0;
+        loader_ = std::async(std::launch::async, [this]() { load_terrain(); });
+    }
+
+    // t[Ă(CXbh)
+    void poll_setup() {
+        if (ready_ || !loader_.valid()) { return; }
+        if (loader_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            return;
+        }
+        loader_.get(); // [J[̗O͂œ
+
+        if (tiled_terrain_.is_open()) {
+            water_.set_constraint(&tiled_terrain_);
+        } else {
+            water_.set_constraint(&constraint_);
+        }
         // mockup();
 
         teams_.push_back(build_team(TeamTag::Alpha, Vector(64, 448)));
@@ -41,13 +79,43 @@ public:
         ready_ = true;
     }
 
+    // ǂݏI܂ő҂
+    void setup() {
+        start_setup();
+        if (loader_.valid()) { loader_.wait(); }
+        poll_setup();
+    }
+
+    // 0..1
+    float load_progress() const { return load_progress_ * 0.001f; }
+
     void update(float elapsed) {
         for (const auto& team: teams_) {
             team->update(elapsed);
         }
 
+        // q̂^CɃ[J[ŃRpCĂ
+        // (constraint̒ł̏ŃRpĈ͓Ă܂Ƃ)
+        if (tiled_terrain_.is_open()) {
+            Vector minp, maxp;
+            if (water_.get_bounds(minp, maxp)) {
+                Vector margin(TERRAIN_PREFETCH_MARGIN, TERRAIN_PREFETCH_MARGIN);
+                tiled_terrain_.prefetch(minp - margin, maxp + margin);
+            }
+        }
+
         water_.update();
 
+        // dt̂Ƃ͂̃t[őIdto('a'Ő؂ւ)
+        if (water_.get_step_mode() == Water::STEP_ADAPTIVE) {
+            if (water_.get_step_count() == 0) {
+                dprintf("water: deferred\n");
+            } else {
+                dprintf("water: %d steps, dt %f\n",
+                        water_.get_step_count(), water_.get_step_dt());
+            }
+        }
+
         for (const auto& team: teams_) {
             team->cleanup();
         }
@@ -60,12 +128,32 @@ public:
 
     bool ready() { return ready_; }
 
-    const gci::Document& terrain() { return terrain_; }
-
     const std::vector<Primitive>& terrain_primitives() { 
+        if (tiled_terrain_.is_open()) { return tiled_terrain_.primitives(); }
         return terrain_primitives_; 
     }
 
+    // terrain_primitives̒gς邽тɐi
+    // (`摤͂ꂪԂ͒_蒼Ȃ)
+    unsigned int terrain_primitives_version() {
+        if (tiled_terrain_.is_open()) {
+            return tiled_terrain_.primitives_version();
+        }
+        return terrain_primitives_version_;
+    }
+
+    // `ɃbVg邩
+    // (^Cn`LbṼbVĂƂPrimitiveŕ`)
+    bool has_terrain_mesh() {
+        return !tiled_terrain_.is_open() && terrain_mesh_valid();
+    }
+    const TerrainMesh& terrain_mesh() { return terrain_mesh_; }
+
+    IConstraint& constraint() {
+        if (tiled_terrain_.is_open()) { return tiled_terrain_; }
+        return constraint_;
+    }
+
     Water& water() { return water_; }
 
 public: 
@@ -74,7 +162,7 @@ public:
     build_team(TeamTag team_tag, const Vector& v) {
         // _
         auto basecamp = std::make_shared<Basecamp>(team_tag, castle_, v);
-        water_.add(v, MASS, basecamp.get());
+        water_.add_static(v, MASS, basecamp.get());
 
         auto team = std::make_shared<Team>(castle_, team_tag, basecamp);
         return team;
@@ -87,10 +175,10 @@ public:
         TeamTag team_tag, const Vector& origin, const Vector& target) {
         auto t = team(team_tag);
         if (0.2f <= t->energy()) {
-            if (constraint_.apply(origin) == origin) {
+            if (constraint().apply(origin) == origin) {
                 t->energy(t->energy() - 0.2f);
                 auto p = t->settle_station(origin, target);
-                water_.add(origin, MASS, p.get());
+                water_.add_static(origin, MASS, p.get());
             }
         }
     }
@@ -102,18 +190,143 @@ public:
     }
 
 public:
-    struct SegmentProperty {
-        int upper_cell_index;
-        int lower_cell_index;
+    // terrain edit
+    // ^Cn`(TERRAIN_WORLD_FILENAME)ł͕ҏWłȂ
+    // (add_wall-1Adestroy_cellfalseԂĉȂ)
+    bool can_edit_terrain() const { return !tiled_terrain_.is_open(); }
+
+    // p0-p1𒆐SƂthickness̕ǂ𑫂
+    // S̗2̃ZɂȂ(߂l͂̐擪̃Zԍ)
+    // ̒n`̐ƌEڐGƂAOg͂ݏoƂ
+    // -1
+    int add_wall(const Vector& p0, const Vector& p1, float thickness) {
+        if (!can_edit_terrain()) {
+            dprintf("add_wall: tiled terrain is not editable\n");
+            return -1;
+        }
+        ensure_terrain_editable();
+
+        Vector d = p1 - p0;
+        float l = D3DXVec2Length(&d);
+        if (l == 0 || !(0 < thickness)) { return -1; }
+        Vector n = Vector(-d.y, d.x) * (thickness * 0.5f / l);
+
+        Vector outline[4] = { p0 + n, p1 + n, p1 - n, p0 - n };
+        if (!wall_fits(outline)) { return -1; }
+
+        // O̒ӂ_ɂ(̗q͂։o)
+        int cell0 = int(cell_sites_.size());
+        Vector a[4] = { p0, p1, p1 + n, p0 + n };
+        Vector b[4] = { p0, p0 - n, p1 - n, p1 };
+        add_terrain_cell(a, 4, p0 + n, p1 + n);
+        add_terrain_cell(b, 4, p0 - n, p1 - n);
+
+        std::vector<Vector> polygons[2] = {
+            std::vector<Vector>(a, a + 4), std::vector<Vector>(b, b + 4)
+        };
+        insert_cell_edges(cell0, polygons, 2);
+        patch_terrain();
+        return cell0;
+    }
+
+    // Z(Ȍʂ蔲A`Ȃ)
+    bool destroy_cell(int cell_index) {
+        if (!can_edit_terrain()) {
+            dprintf("destroy_cell: tiled terrain is not editable\n");
+            return false;
+        }
+        if (cell_index < 0 || int(cell_primitives_.size()) <= cell_index) {
+            return false;
+        }
+        ensure_terrain_editable();
+
+        for (size_t i = 0 ; i < terrain_segments_.size() ; i++) {
+            SegmentProperty sp = terrain_segments_[i].sp;
+            if (sp.upper_cell_index != cell_index &&
+                sp.lower_cell_index != cell_index) {
+                continue;
+            }
+            if (sp.upper_cell_index == cell_index) {
+                sp.upper_cell_index = -1;
+            }
+            if (sp.lower_cell_index == cell_index) {
+                sp.lower_cell_index = -1;
+            }
+            terrain_segments_[i].sp = sp;
+            tm_.set_property(segment_handles_[i], sp);
+        }
+        patch_terrain();
+
+        const CellPrimitives& cp = cell_primitives_[cell_index];
+        for (int i = 0 ; i < cp.outline_count ; i++) {
+            terrain_primitives_[cp.outline_first + i].opcode =
+                Primitive::Empty;
+        }
+        for (int i = 0 ; i < cp.fill_count ; i++) {
+            terrain_primitives_[cp.fill_first + i].opcode = Primitive::Empty;
+        }
+        terrain_primitives_version_++;
+
+        destroy_mesh_cell(cell_index);
+        return true;
+    }
+
+    // LbVNꍇAŏ̕ҏW̑O
+    // TrapezoidalMap蒼Kv([hʂȂǂŌĂł)
+    void ensure_terrain_editable() {
+        if (terrain_editable_ || !can_edit_terrain()) { return; }
+
+        // compile_terrain_mapƓ[̏𒴂蒼
+        ArrayView<TerrainSegment> cached =
+            terrain_cache_.section<TerrainSegment>(TerrainCache::Segments);
+        std::vector<TerrainSegment> segments(cached.begin(), cached.end());
+        tm_.clear();
+        segment_handles_.resize(segments.size());
+        build_terrain_map(
+            tm_, segments, terrain_depth_bound(segments.size()),
+            [this](size_t i, const TerrainSegment& ts) {
+                segment_handles_[i] = tm_.add_segment(
+                    tm_.make_point(ts.p0.x, ts.p0.y),
+                    tm_.make_point(ts.p1.x, ts.p1.y),
+                    true, ts.sp);
+            });
+        terrain_segments_ = segments;
+        tmm_.init(tm_);
+        compiled_code_size_ = tmm_.image_size();
+
+        // Ȍ̓LbṼRs[
+        cell_site_storage_.assign(cell_sites_.begin(), cell_sites_.end());
+        cell_sites_ = ArrayView<CellSite>(cell_site_storage_);
+        terrain_cache_.close();
+
+        terrain_editable_ = true;
+    }
+
+    // _ʒu̒g(-bench patch𓖂ĂR[h𒲂ׂ)
+    // LbVNƂ͍ŏ̕ҏW܂terrain_map͋
+    const TerrainMap& terrain_map() const { return tm_; }
+    const TerrainMachine& terrain_machine() const { return tmm_; }
+    bool uses_terrain_cache() const { return terrain_cache_.is_open(); }
+
+public:
+    typedef TerrainSegmentProperty  SegmentProperty;
+    typedef TerrainCellSite         CellSite;
+
+    // ZƂterrain_primitives_͈̔
+    struct CellPrimitives {
+        int outline_first;
+        int outline_count;
+        int fill_first;
+        int fill_count;
     };
 
 private:
     class TrapezoidalMapConstraint : public IConstraint {
     public:
         TrapezoidalMapConstraint(
-            gci::Document& doc,
+            const ArrayView<CellSite>& cell_sites,
             TrapezoidalMapMachine<float, SegmentProperty>& tmm)
-            : document_(doc), tmm_(tmm) {}
+            : cell_sites_(cell_sites), tmm_(tmm) {}
 
         D3DXVECTOR2 apply(const D3DXVECTOR2& vv) {
             D3DXVECTOR2 v = vv;
@@ -128,236 +341,530 @@ private:
             if (maxx <= v.x) { v.x = maxx; }
             if (maxy <= v.y) { v.y = maxy; }
 
-            TrapezoidalMap<float, SegmentProperty>::Point q;
-            int score;
-            D3DXVECTOR2 qv(v.x, v.y);
-            q.x(qv.x);
-            q.y(qv.y);
-
-            SegmentProperty tsp;
-            SegmentProperty bsp;
-
-            if (tmm_.find(q, score, tsp, bsp)) {
-                if (0 <= tsp.lower_cell_index) {
-                    const gci::Document::Cell& cell =
-                        document_.voronoi_cells[tsp.lower_cell_index];
-
-                    const gci::Document::Site& site =
-                        document_.sites[cell.site_index];
-
-                    D3DXVECTOR2 qv2;
-                    if (site.is_segment) {
-                        qv2 = nearest_point_on_line(
-                            document_.vertices[site.p0],
-                            document_.vertices[site.p1],
-                            qv);
-                    } else {
-                        qv2 = document_.vertices[site.p0];
-                    }
-
-                    v =(qv2 - qv)* 0.5f + qv;
-                }
-            }
-
-            return v;
+            return apply_terrain_constraint(tmm_, cell_sites_, v);
         }
 
     private:
-        D3DXVECTOR2 nearest_point_on_line(
-            const D3DXVECTOR2& p0,
-            const D3DXVECTOR2& p1,
-            const D3DXVECTOR2& q) {
-            float dx = p1.x - p0.x;
-            float dy = p1.y - p0.y;
-            float a = dx * dx + dy * dy;
-            if (a == 0) { return p0; }
-
-            float b = dx *(p0.x - q.x)+ dy *(p0.y - q.y);
-            float t = -(b / a);
-            if (t <0.0f) { t = 0.0f; }
-            if (1.0f <t) { t = 1.0f; }
-            return D3DXVECTOR2(p0.x + dx * t, p0.y + dy * t);
-        }
-
-    private:
-        gci::Document&                                      document_;
+        const ArrayView<CellSite>&                          cell_sites_;
         TrapezoidalMapMachine<float, SegmentProperty>&      tmm_;
     };
 
-    gci::Document terrain_;
     TrapezoidalMap<float, SegmentProperty> tm_;
     TrapezoidalMapMachine<float, SegmentProperty> tmm_;
     TrapezoidalMapConstraint constraint_;
+    TiledTerrain             tiled_terrain_;
+
+    // compile_terrainṓA܂̓LbV𒼐ڎw
+    ArrayView<CellSite>         cell_sites_;
+    std::vector<CellSite>       cell_site_storage_;
+    std::vector<TerrainSegment> terrain_segments_;
+    std::vector<CellPrimitives> cell_primitives_;
+    TerrainCache                terrain_cache_;
+
+    // terrain edit
+    typedef TrapezoidalMap<float, SegmentProperty>::Segment TerrainMapSegment;
+    std::vector<TerrainMapSegment*> segment_handles_;
+    bool                            terrain_editable_;
+    size_t                          compiled_code_size_;
+    int                             color_index_;
 
     Castle      castle_;
     Water       water_;
 
     bool ready_;
 
-    void compile_terrain(const gci::Document& doc) {
-        // LINE
-        Primitive p;
-        p.opcode = Primitive::Color;
-        p.operands[0] = 0;
-        p.operands[1] = 0;
-        p.operands[2] = 0;
-        terrain_primitives_.push_back(p);
+    // 牺̓[J[Xbhő
+    // (ready_܂ŃCXbh͒n`ɐGȂ)
+    void load_terrain() {
+        if (tiled_terrain_.open(TERRAIN_WORLD_FILENAME)) {
+            load_progress_ = 1000;
+            return;
+        }
 
-        for (size_t i = 0 ; i < doc.voronoi_cells.size() ; i++) {
-            const std::vector<int>& v = doc.voronoi_cells[i].vertex_indices;
-            Primitive p;
-            p.opcode = Primitive::MoveTo;
-            p.operands[0] = doc.vertices[v.back()].x;
-            p.operands[1] = doc.vertices[v.back()].y;
-            terrain_primitives_.push_back(p);
-            for (size_t j = 0 ; j <v.size(); j++) {
-                p.opcode = Primitive::LineTo;
-                p.operands[0] = doc.vertices[v[j]].x;
-                p.operands[1] = doc.vertices[v[j]].y;
-                terrain_primitives_.push_back(p);
+        // .gcb΂D悷(mmapĂ̂܂ܓǂ)
+        gci::MappedDocument binary;
+        bool has_binary = binary.open(TERRAIN_BINARY_FILENAME);
+        boost::uint64_t hash = hash_file(
+            has_binary ? TERRAIN_BINARY_FILENAME : TERRAIN_FILENAME);
+        if (!load_terrain_cache(TERRAIN_CACHE_FILENAME, hash)) {
+            load_progress_ = 50;
+            if (has_binary) {
+                compile_terrain(binary);
+            } else {
+                gci::Document doc;
+                if (!read_gci(TERRAIN_FILENAME, doc)) {
+                    // n`ȂŎn߂(LbV͍Ȃ)
+                    dprintf("cannot read %s\n", TERRAIN_FILENAME);
+                    hash = 0;
+                }
+                load_progress_ = 300;
+                compile_terrain(doc);
             }
+            save_terrain_cache(TERRAIN_CACHE_FILENAME, hash);
+        }
+        load_progress_ = 1000;
+    }
+
+    // Documentgci::Documentgci::MappedDocument
+    // _ʒũRpCPrimitive͐G郁oʂȂ̂ŕsɑ点
+    template <class Document>
+    void compile_terrain(const Document& doc) {
+        std::future<void> map = std::async(
+            std::launch::async,
+            [this, &doc]() { compile_terrain_map(doc); });
+        compile_terrain_primitives(doc);
+        map.get();
+    }
+
+    template <class Document>
+    void compile_terrain_primitives(const Document& doc) {
+        size_t cell_count = doc.cell_count();
+
+        // cell sites
+        cell_site_storage_.clear();
+        for (size_t i = 0 ; i < cell_count ; i++) {
+            cell_site_storage_.push_back(make_terrain_cell_site(doc, int(i)));
+        }
+        cell_sites_ = ArrayView<CellSite>(cell_site_storage_);
+
+        // LINE
+        terrain_primitives_.clear();
+        terrain_primitives_version_++;
+        post_color(terrain_primitives_, 0, 0, 0);
+
+        cell_primitives_.resize(cell_count);
+        for (size_t i = 0 ; i < cell_count ; i++) {
+            cell_primitives_[i].outline_first =
+                int(terrain_primitives_.size());
+            post_cell_outline(doc, int(i), terrain_primitives_);
+            cell_primitives_[i].outline_count =
+                int(terrain_primitives_.size()) -
+                cell_primitives_[i].outline_first;
         }
 
         // POLYGON
+        color_index_ = 0;
+        for (size_t i = 0 ; i < cell_count; i++) {
+            post_random_color(terrain_primitives_, color_index_);
+
+            cell_primitives_[i].fill_first = int(terrain_primitives_.size());
+            post_cell_fill(doc, int(i), terrain_primitives_);
+            cell_primitives_[i].fill_count =
+                int(terrain_primitives_.size()) -
+                cell_primitives_[i].fill_first;
+        }
+
+        // ̂CfbNXtbVł
+        std::vector<int> cells(cell_count);
+        for (size_t i = 0 ; i < cells.size() ; i++) { cells[i] = int(i); }
         int color_index = 0;
-        for (size_t i = 0 ; i < doc.voronoi_cells.size(); i++) {
-            post_random_color(terrain_primitives_, color_index);
-
-            const std::vector<gci::Document::Triangle>& v =
-                doc.voronoi_cells[i].triangles;
-
-            for (size_t j = 0 ; j <v.size(); j++) {
-                p.opcode = Primitive::MoveTo;
-                p.operands[0] = doc.vertices[v[j].v0].x;
-                p.operands[1] = doc.vertices[v[j].v0].y;
-                terrain_primitives_.push_back(p);
-
-                p.opcode = Primitive::Triangle;
-                p.operands[0] = doc.vertices[v[j].v1].x;
-                p.operands[1] = doc.vertices[v[j].v1].y;
-                p.operands[2] = doc.vertices[v[j].v2].x;
-                p.operands[3] = doc.vertices[v[j].v2].y;
-                terrain_primitives_.push_back(p);
+        build_terrain_mesh(
+            doc, ArrayView<int>(cells), color_index, terrain_mesh_);
+        dprintf("terrain primitives: %d, expanded %d bytes\n",
+                int(terrain_primitives_.size()),
+                int(expanded_primitive_size(terrain_primitives_)));
+    }
+
+    // PathviewRendererWJƂ̒_̃oCg
+    static size_t expanded_primitive_size(
+        const std::vector<Primitive>& primitives) {
+        const size_t vertex_size = sizeof(D3DXVECTOR4) + sizeof(DWORD);
+        size_t n = 0;
+        for (size_t i = 0 ; i < primitives.size() ; i++) {
+            switch (primitives[i].opcode) {
+                case Primitive::LineTo:     n += 2; break;
+                case Primitive::Triangle:   n += 3; break;
+                default:                    break;
             }
         }
+        return n * vertex_size;
+    }
 
-        // point location
-        std::vector<TrapezoidalMap<float, SegmentProperty>::Point> 
-            points;
-        for (size_t i = 0 ; i < doc.vertices.size() ; i++) {
-            points.push_back(tm_.make_point(doc.vertices[i].x,
-                                            doc.vertices[i].y));
-        }
+    template <class Document>
+    void compile_terrain_map(const Document& doc) {
+        std::vector<int> cells(doc.cell_count());
+        for (size_t i = 0 ; i < cells.size() ; i++) { cells[i] = int(i); }
+
+        std::vector<TerrainSegment> segments;
+        collect_terrain_segments(doc, ArrayView<int>(cells), segments);
+
+        // }ԏd̂Ői͂ō(300..900)
+        // [𒴂č蒼Ƃ͍ŏ琔
+        int progress0 = load_progress_;
+        segment_handles_.resize(segments.size());
+        build_terrain_map(
+            tm_, segments, terrain_depth_bound(segments.size()),
+            [this, progress0, &segments](
+                size_t i, const TerrainSegment& ts) {
+                segment_handles_[i] = tm_.add_segment(
+                    tm_.make_point(ts.p0.x, ts.p0.y),
+                    tm_.make_point(ts.p1.x, ts.p1.y),
+                    true, ts.sp);
+                if ((i & 255) == 0) {
+                    load_progress_ = progress0 +
+                        int((900 - progress0) * i / segments.size());
+                }
+            });
+        terrain_segments_ = segments;
 
-        int m = 0;
-        std::map<std::pair<int, int>, SegmentProperty> segments;
-        for (size_t i = 0 ; i <doc.voronoi_cells.size() ; i++) {
-            const std::vector<int>& v = doc.voronoi_cells[i].vertex_indices;
+        tmm_.init(tm_);
+        compiled_code_size_ = tmm_.image_size();
+        terrain_editable_ = true;
+        load_progress_ = 950;
+    }
 
-            for (size_t j = 0 ; j <v.size(); j++) {
-                int index0 = v[j];
-                int index1 = v[(j+1)% v.size()];
+    // ǂ̊O`(ʎlp`)Og̓ɂA̐
+    // EڐGA̐𒆂Ɋ܂܂Ȃ
+    // (S͊O`̓Ȃ̂ŊO`Α)
+    bool wall_fits(const Vector outline[4]) const {
+        for (int i = 0 ; i < 4 ; i++) {
+            const Vector& v = outline[i];
+            if (!(tm_.bbmin().x() < v.x && v.x < tm_.bbmax().x() &&
+                  tm_.bbmin().y() < v.y && v.y < tm_.bbmax().y())) {
+                return false;
+            }
+        }
 
-                // lexicographical compare
-                bool invert = !(points[index0] <points[index1]);
-
-                if (index1 <index0) { std::swap(index0, index1); }
-                std::pair<int, int> s = std::make_pair(index0, index1);
-
-                if (segments.find(s) == segments.end()) {
-                    SegmentProperty sp;
-                    sp.upper_cell_index = -1;
-                    sp.lower_cell_index = -1;
-                    if (invert) {
-                        sp.upper_cell_index = int(i);
-                    } else {
-                        sp.lower_cell_index = int(i);
-                    }
-                    segments[s] = sp;
-                    m++;
-                    //tm_.add_segment(points[index0], points[index1]);
-                } else {
-                    SegmentProperty& sp = segments[s];
-                    if (invert) {
-                        sp.upper_cell_index = int(i);
-                    } else {
-                        sp.lower_cell_index = int(i);
-                    }
+        // O`̌(ǂłł悤)
+        Vector e0 = outline[1] - outline[0];
+        Vector e1 = outline[2] - outline[1];
+        float orientation = e0.x * e1.y - e0.y * e1.x;
+        auto inside = [&outline, orientation](const Vector& p) {
+            for (int i = 0 ; i < 4 ; i++) {
+                const Vector& a = outline[i];
+                const Vector& b = outline[(i + 1) % 4];
+                float c = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+                if (!(0 < c * orientation)) { return false; }
+            }
+            return true;
+        };
+
+        for (const TerrainSegment& ts: terrain_segments_) {
+            if (inside(ts.p0) || inside(ts.p1)) { return false; }
+            for (int i = 0 ; i < 4 ; i++) {
+                if (terrain_segments_touch(
+                        outline[i], outline[(i + 1) % 4], ts.p0, ts.p1)) {
+                    return false;
                 }
             }
         }
+        return true;
+    }
+
+    void insert_terrain_segment(
+        const D3DXVECTOR2& p0, const D3DXVECTOR2& p1,
+        const SegmentProperty& sp) {
+        segment_handles_.push_back(
+            tm_.add_segment(
+                tm_.make_point(p0.x, p0.y), tm_.make_point(p1.x, p1.y),
+                true, sp));
+
+        TerrainSegment ts;
+        ts.p0 = p0;
+        ts.p1 = p1;
+        ts.sp = sp;
+        terrain_segments_.push_back(ts);
+    }
+
+    void add_terrain_cell(
+        const Vector* polygon, int n, const Vector& site0, const Vector& site1) {
+        bool mesh_valid = terrain_mesh_valid();
+
+        CellSite cs;
+        cs.p0 = site0;
+        cs.p1 = site1;
+        cs.is_segment = 1;
+        cell_site_storage_.push_back(cs);
+        cell_sites_ = ArrayView<CellSite>(cell_site_storage_);
 
-        struct Seg {
-            int    index0;
-            int    index1;
+        // LINE
+        CellPrimitives cp;
+        post_color(terrain_primitives_, 0, 0, 0);
+
+        Primitive p;
+        cp.outline_first = int(terrain_primitives_.size());
+        cp.outline_count = n + 1;
+        p.opcode = Primitive::MoveTo;
+        p.operands[0] = polygon[n-1].x;
+        p.operands[1] = polygon[n-1].y;
+        terrain_primitives_.push_back(p);
+        for (int i = 0 ; i < n ; i++) {
+            p.opcode = Primitive::LineTo;
+            p.operands[0] = polygon[i].x;
+            p.operands[1] = polygon[i].y;
+            terrain_primitives_.push_back(p);
+        }
+
+        // POLYGON(ʂȂ̂Ő`ɕ)
+        unsigned long color = next_terrain_color(color_index_);
+        post_rgb(terrain_primitives_, color);
+        cp.fill_first = int(terrain_primitives_.size());
+        cp.fill_count = (n - 2) * 2;
+        for (int i = 1 ; i < n - 1 ; i++) {
+            p.opcode = Primitive::MoveTo;
+            p.operands[0] = polygon[0].x;
+            p.operands[1] = polygon[0].y;
+            terrain_primitives_.push_back(p);
+
+            p.opcode = Primitive::Triangle;
+            p.operands[0] = polygon[i].x;
+            p.operands[1] = polygon[i].y;
+            p.operands[2] = polygon[i+1].x;
+            p.operands[3] = polygon[i+1].y;
+            terrain_primitives_.push_back(p);
+        }
+        cell_primitives_.push_back(cp);
+        terrain_primitives_version_++;
+
+        // mesh(֊sinsert_cell_edgeső)
+        if (!mesh_valid) { return; }
+        int base = int(terrain_mesh_.fill_vertices.size());
+        for (int i = 0 ; i < n ; i++) {
+            TerrainMeshVertex mv;
+            mv.p = polygon[i];
+            mv.color = 0x40000000 | boost::uint32_t(color);
+            terrain_mesh_.fill_vertices.push_back(mv);
+        }
+        for (int i = 1 ; i < n - 1 ; i++) {
+            terrain_mesh_.fill_indices.push_back(base);
+            terrain_mesh_.fill_indices.push_back(base + i);
+            terrain_mesh_.fill_indices.push_back(base + i + 1);
+        }
+        terrain_mesh_.cell_fill_offsets.push_back(
+            int(terrain_mesh_.fill_indices.size()));
+        finish_terrain_mesh(terrain_mesh_);
+    }
+
+    // cell0n܂Z̕ӂdđ}
+    // ̌ߕcompile_terrainƓ(.gcĩZƓɑ)
+    void insert_cell_edges(
+        int cell0, std::vector<Vector>* polygons, int polygon_count) {
+        struct Edge {
+            Vector          p0;
+            Vector          p1;
             SegmentProperty sp;
         };
+        std::vector<Edge> edges;
+
+        for (int k = 0 ; k < polygon_count ; k++) {
+            std::vector<Vector>& v = polygons[k];
 
-        std::vector<Seg> segments2;
-        for (const auto& p: segments){
-            Seg seg;
-            seg.index0 = p.first.first;
-            seg.index1 = p.first.second;
-            seg.sp = p.second;
-            segments2.push_back(seg);
-        }
-
-        // Vbt
-        class Random {
-        public:
-            boost::mt19937 gen;
-            boost::uniform_int<int> dst;
-            boost::variate_generator<boost::mt19937, boost::uniform_int<int>>
-                rand;
-            Random(unsigned long seed, int N)
-                : gen(seed), dst(0, N), rand(gen, dst) {
+            float area = 0;
+            for (size_t j = 0 ; j < v.size() ; j++) {
+                const Vector& a = v[j];
+                const Vector& b = v[(j+1) % v.size()];
+                area += a.x * b.y - b.x * a.y;
             }
-            std::ptrdiff_t operator()(std::ptrdiff_t arg) {
-                return static_cast<std::ptrdiff_t>(rand());
+            if (area < 0) { std::reverse(v.begin(), v.end()); }
+
+            for (size_t j = 0 ; j < v.size() ; j++) {
+                Vector p0 = v[j];
+                Vector p1 = v[(j+1) % v.size()];
+
+                // lexicographical compare
+                bool invert = !(tm_.make_point(p0.x, p0.y) <
+                                tm_.make_point(p1.x, p1.y));
+                if (invert) { std::swap(p0, p1); }
+
+                size_t e = 0;
+                while (e < edges.size() &&
+                       !(edges[e].p0 == p0 && edges[e].p1 == p1)) {
+                    e++;
+                }
+                if (e == edges.size()) {
+                    Edge edge;
+                    edge.p0 = p0;
+                    edge.p1 = p1;
+                    edge.sp.upper_cell_index = -1;
+                    edge.sp.lower_cell_index = -1;
+                    edges.push_back(edge);
+                }
+                if (invert) {
+                    edges[e].sp.upper_cell_index = cell0 + k;
+                } else {
+                    edges[e].sp.lower_cell_index = cell0 + k;
+                }
             }
-        };
+        }
 
-        //Random rnd((unsigned long)time(NULL), segments2.size());
-        Random rnd(0, segments2.size());
+        for (size_t e = 0 ; e < edges.size() ; e++) {
+            insert_terrain_segment(edges[e].p0, edges[e].p1, edges[e].sp);
+        }
 
-        std::random_shuffle(segments2.begin(), segments2.end(), rnd);
+        // mesh(_͂őZ̊ԂłL)
+        if (!terrain_mesh_valid()) { return; }
+        TerrainMesh& mesh = terrain_mesh_;
+        size_t vertex0 = mesh.edge_vertices.size();
+        for (size_t e = 0 ; e < edges.size() ; e++) {
+            Vector ends[2] = { edges[e].p0, edges[e].p1 };
+            for (int j = 0 ; j < 2 ; j++) {
+                size_t k = vertex0;
+                while (k < mesh.edge_vertices.size() &&
+                       !(mesh.edge_vertices[k] == ends[j])) {
+                    k++;
+                }
+                if (k == mesh.edge_vertices.size()) {
+                    mesh.edge_vertices.push_back(ends[j]);
+                }
+                mesh.edge_indices.push_back(boost::uint32_t(k));
+            }
+            mesh.edge_cells.push_back(edges[e].sp);
+        }
+        finish_terrain_mesh(mesh);
+    }
 
-        for (std::vector<Seg>::const_iterator i = segments2.begin();
-             i != segments2.end();
-             ++i) {
-            tm_.add_segment(
-                points[(*i).index0],
-                points[(*i).index1],
-                true,
-                (*i).sp);
+    bool terrain_mesh_valid() const {
+        return terrain_mesh_.cell_fill_offsets.size() == cell_sites_.size() + 1;
+    }
+
+    // Z̓hׂAǂ瑤̃ZȂȂ֊s
+    void destroy_mesh_cell(int cell_index) {
+        if (!terrain_mesh_valid()) { return; }
+        TerrainMesh& mesh = terrain_mesh_;
+
+        int first = mesh.cell_fill_offsets[cell_index];
+        int last = mesh.cell_fill_offsets[cell_index + 1];
+        for (int i = first ; i < last ; i++) {
+            mesh.fill_indices[i] = mesh.fill_indices[first];
         }
 
-        water_.set_constraint(&constraint_);
+        size_t n = 0;
+        for (size_t e = 0 ; e < mesh.edge_cells.size() ; e++) {
+            SegmentProperty sp = mesh.edge_cells[e];
+            if (sp.upper_cell_index == cell_index) {
+                sp.upper_cell_index = -1;
+            }
+            if (sp.lower_cell_index == cell_index) {
+                sp.lower_cell_index = -1;
+            }
+            if (sp.upper_cell_index < 0 && sp.lower_cell_index < 0) {
+                continue;
+            }
+            mesh.edge_cells[n] = sp;
+            mesh.edge_indices[n * 2 + 0] = mesh.edge_indices[e * 2 + 0];
+            mesh.edge_indices[n * 2 + 1] = mesh.edge_indices[e * 2 + 1];
+            n++;
+        }
+        mesh.edge_cells.resize(n);
+        mesh.edge_indices.resize(n * 2);
+        finish_terrain_mesh(mesh);
+    }
 
-        tmm_.init(tm_);
+    // ύXR[hɓĂ
+    // JUMPƎ񂾗tŖc݂蒼
+    void patch_terrain() {
+        tmm_.patch(tm_);
+        if (compiled_code_size_ * 2 < tmm_.image_size()) {
+            tmm_.init(tm_);
+            compiled_code_size_ = tmm_.image_size();
+        }
     }
 
-    std::vector<Command>    terrain_commands_; 
-    std::vector<Primitive>  terrain_primitives_; 
+    bool load_terrain_cache(const char* filename, boost::uint64_t hash) {
+        if (hash == 0) { return false; } // .gci/.gcbǂ߂Ȃ
+        if (!terrain_cache_.load(filename, hash)) { return false; }
+
+        ArrayView<char> code =
+            terrain_cache_.section<char>(TerrainCache::Code);
+        ArrayView<Primitive> primitives =
+            terrain_cache_.section<Primitive>(TerrainCache::Primitives);
+        ArrayView<CellSite> cell_sites =
+            terrain_cache_.section<CellSite>(TerrainCache::CellSites);
+        ArrayView<CellPrimitives> cell_primitives =
+            terrain_cache_.section<CellPrimitives>(
+                TerrainCache::CellPrimitives);
+        if (code.empty() || cell_sites.empty() ||
+            cell_primitives.size() != cell_sites.size()) {
+            terrain_cache_.close();
+            return false;
+        }
 
-    void post_random_color(std::vector<Primitive>& pb, int& color_index) {
-        unsigned long color;
-        do {
-            color = get_color(color_index++);
-        } while (get_color_distance(0xffffff, color)<0.1f);
+        // R[hƃZmmap̂܂܎g
+        tmm_.attach(code.data(), code.size());
+        cell_sites_ = cell_sites;
+
+        // PathviewRenderervectorv̂łRs[
+        terrain_primitives_.assign(primitives.begin(), primitives.end());
+        terrain_primitives_version_++;
+        cell_primitives_.assign(
+            cell_primitives.begin(), cell_primitives.end());
+        load_terrain_mesh();
+        color_index_ = int(cell_sites.size());
+        return true;
+    }
 
-        float r =((color & 0xff0000) >> 16)/ 255.0f;
-        float g =((color & 0x00ff00) >>  8)/ 255.0f;
-        float b =((color & 0x0000ff))/ 255.0f;
+    void save_terrain_cache(const char* filename, boost::uint64_t hash) {
+        if (hash == 0) { return; }
+
+        std::vector<char> code(
+            tmm_.image(), tmm_.image() + tmm_.image_size());
+
+        TerrainCache::Writer w;
+        w.add(TerrainCache::Code, code);
+        w.add(TerrainCache::Segments, terrain_segments_);
+        w.add(TerrainCache::Primitives, terrain_primitives_);
+        w.add(TerrainCache::CellSites, cell_site_storage_);
+        w.add(TerrainCache::CellPrimitives, cell_primitives_);
+        w.add(TerrainCache::MeshEdgeVertices, terrain_mesh_.edge_vertices);
+        w.add(TerrainCache::MeshEdgeIndices, terrain_mesh_.edge_indices);
+        w.add(TerrainCache::MeshEdgeCells, terrain_mesh_.edge_cells);
+        w.add(TerrainCache::MeshFillVertices, terrain_mesh_.fill_vertices);
+        w.add(TerrainCache::MeshFillIndices, terrain_mesh_.fill_indices);
+        w.add(TerrainCache::MeshCellFillOffsets,
+              terrain_mesh_.cell_fill_offsets);
+        w.write(filename, hash); // sĂRpC
+    }
 
-        Primitive p;
-        p.opcode = Primitive::Color;
-        p.operands[0] = r;
-        p.operands[1] = g;
-        p.operands[2] = b;
-        pb.push_back(p);
+    // LbṼbVRs[
+    // Ăɂ(Primitiveŕ`)
+    void load_terrain_mesh() {
+        TerrainMesh& mesh = terrain_mesh_;
+        mesh.clear();
+
+        ArrayView<D3DXVECTOR2> edge_vertices =
+            terrain_cache_.section<D3DXVECTOR2>(
+                TerrainCache::MeshEdgeVertices);
+        ArrayView<boost::uint32_t> edge_indices =
+            terrain_cache_.section<boost::uint32_t>(
+                TerrainCache::MeshEdgeIndices);
+        ArrayView<SegmentProperty> edge_cells =
+            terrain_cache_.section<SegmentProperty>(
+                TerrainCache::MeshEdgeCells);
+        ArrayView<TerrainMeshVertex> fill_vertices =
+            terrain_cache_.section<TerrainMeshVertex>(
+                TerrainCache::MeshFillVertices);
+        ArrayView<boost::uint32_t> fill_indices =
+            terrain_cache_.section<boost::uint32_t>(
+                TerrainCache::MeshFillIndices);
+        ArrayView<int> cell_fill_offsets =
+            terrain_cache_.section<int>(TerrainCache::MeshCellFillOffsets);
+        if (edge_indices.size() != edge_cells.size() * 2 ||
+            cell_fill_offsets.size() != cell_sites_.size() + 1 ||
+            cell_fill_offsets.back() != int(fill_indices.size())) {
+            return;
+        }
+        for (boost::uint32_t i: edge_indices) {
+            if (edge_vertices.size() <= i) { return; }
+        }
+        for (boost::uint32_t i: fill_indices) {
+            if (fill_vertices.size() <= i) { return; }
+        }
+
+        mesh.edge_vertices.assign(edge_vertices.begin(), edge_vertices.end());
+        mesh.edge_indices.assign(edge_indices.begin(), edge_indices.end());
+        mesh.edge_cells.assign(edge_cells.begin(), edge_cells.end());
+        mesh.fill_vertices.assign(fill_vertices.begin(), fill_vertices.end());
+        mesh.fill_indices.assign(fill_indices.begin(), fill_indices.end());
+        mesh.cell_fill_offsets.assign(
+            cell_fill_offsets.begin(), cell_fill_offsets.end());
+        finish_terrain_mesh(mesh);
     }
 
+    std::vector<Command>    terrain_commands_; 
+    std::vector<Primitive>  terrain_primitives_; 
+    TerrainMesh             terrain_mesh_;
+    unsigned int            terrain_primitives_version_;
+
 private:
     void mockup() {
     }
@@ -365,6 +872,10 @@ private:
 private:
     std::vector<std::shared_ptr<Team>> teams_;
 
+    // Ōɒu(jɂ܂[J[̏I҂)
+    std::atomic<int>    load_progress_; // 1/1000P
+    std::future<void>   loader_;
+
 };
 
 #endif // BOARD_HPP_
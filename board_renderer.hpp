@@ -12,6 +12,7 @@
 
 #include "pathview.hpp"
 #include "pathview_renderer.hpp"
+#include "terrain_renderer.hpp"
 
 class BoardRenderer {
 public:
@@ -23,10 +24,18 @@ public:
     void render(LPDIRECT3DDEVICE9 device) {
         if (!board_.ready()) { return; }
 
-        terrain_renderer_.render(
-            device,
-            board_.terrain_primitives(), 
-            board_.terrain_primitives().size());
+        if (board_.has_terrain_mesh()) {
+            terrain_mesh_renderer_.render(device, board_.terrain_mesh());
+        } else {
+            // ^Cn`terrain_primitives̒ō蒼̂ŐɌĂ
+            const std::vector<Primitive>& primitives =
+                board_.terrain_primitives();
+            terrain_renderer_.render(
+                device,
+                primitives,
+                int(primitives.size()),
+                board_.terrain_primitives_version());
+        }
         board_.water().render(device);
     }
 
@@ -35,6 +44,7 @@ private:
 private:
     Board&              board_;
     PathviewRenderer    terrain_renderer_;
+    TerrainRenderer     terrain_mesh_renderer_;
     
 };
 
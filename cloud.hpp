@@ -1,16 +1,18 @@
 // 2008/12/24 Naoyuki Hirayama
 
 /*!
-	@file	  sph.hpp
+	@file	  cloud.hpp
 	@brief	  <Tv>
 
 	ȗsph oȂ
 */
 
-#ifndef SPH_HPP_
-#define SPH_HPP_
+#ifndef CLOUD_HPP_
+#define CLOUD_HPP_
 
-#include "performance_counter.hpp"
+#include <vector>
+#include <limits>
+#include "neighbor_search.hpp"
 
 //  mm
 //  g
@@ -26,7 +28,6 @@ private:
     typedef typename Traits::load_type      load_type;
 
     struct Particle {
-        Particle* next;
         int   id;
 
         vector_type position;
@@ -42,31 +43,6 @@ private:
         real_type length;
     };
 
-    class HashTable {
-    public:
-        template <class V>
-        HashTable(V& v) {
-            memset(table_, 0, sizeof(table_));
-
-            for (Particle& pi: v) {
-                int coord[Traits::DIMENSION];
-                Traits::make_coords(coord, pi.position);
-                size_t h = Traits::hash(coord, TABLE_SIZE);
-                pi.next = table_[h];
-                table_[h] = &pi;
-            }
-        }
-        ~HashTable() {}
-
-        Particle* find(const int a[]) {
-            return table_[Traits::hash(a, TABLE_SIZE)];
-        }
-
-    private:
-        enum { TABLE_SIZE = 4997 };
-        Particle* table_[TABLE_SIZE];
-    };
-
 public:
     cloud() {}
     ~cloud() {}
@@ -77,24 +53,31 @@ public:
 
     void add_particle(const vector_type& v, const load_type& load) {
         Particle p;
+        p.id = int(particles_.size());
         p.position = v / src_search_radius_;
+        p.force = Traits::zero_vector();
         p.load = load;
         particles_.push_back(p);
     }
 
+    // posɈԋ߂q̔ԍ(2悪range傫-1)
     int pick(const vector_type& pos, real_type range) {
-        real_type maxlen =(std::numeric_limits<real_type>::max)();  
+        real_type maxlen = (std::numeric_limits<real_type>::max)();
+
+        int id = -1;
+        for (const Particle& p: particles_) {
+            real_type len = Traits::length_sq(
+                p.position * src_search_radius_ - pos);
+            if (len < maxlen) {
+                maxlen = len;
+                id = p.id;
+            }
+        }
 
-        auto i = std::min_element(
-            particles_.cbegin(), 
-            particles_.cend(),
-            [](const Particle& p) {
-                return Traits::length_square(p.position - pos);
-            });
-        if (i == particles_.cend() || maxlen < range) {
-            return -1;
+        if (maxlen <= range) {
+            return id;
         }
-        return id;
+        return -1;
     }
 
     template <class F>
@@ -123,8 +106,7 @@ public:
 
         for (Pair& p: pairs_) {
             if (p.length == 0) { continue; }  // 񖳎
-            float rd = square(1.0f - p.length_sq);
-            vector_type v = p.diff * (rd * dt * 60.0f);
+            vector_type v = repulsion(p.diff, p.length_sq, dt * 60.0f);
             p.car->force -= v;
             p.cdr->force += v;
         }
@@ -136,81 +118,51 @@ public:
     }
 
 private:
-    template <int M>
-    struct update_pairs_n {
-        template <int N>
-        struct when_n {
-            static void exec(
-                Particle& pi,
-                HashTable& ht,
-                const int coords[2][M], // 2 means min, max
-                int c[M],
-                std::vector<Pair>& pairs) {
-                for (int i = coords[0][M-N] ; i <= coords[1][M-N] ; i++) {
-                    c[M-N] = i;
-                    when_n<N-1>::exec(pi, ht, coords, c, pairs);
-                }
-            }
-        };
-
-        template <>
-        struct when_n<0> {
-            static void exec(
-                Particle& pi,
-                HashTable& ht,
-                const int coords[2][M], // 2 means min, max
-                int c[M],
-                std::vector<Pair>& pairs) {
-                for (Particle* p = ht.find(c); p ; p = p->next) {
-                    Particle& pj = *p;
-                    if (&pj <= &pi) { continue; }
-
-                    vector_type v = pj.position - pi.position;
-                    real_type length_sq = Traits::length_sq(v);
-                    if (real_type(1.0) <= length_sq) { continue; }
-
-                    Pair pair;
-                    pair.car = &pi;
-                    pair.cdr = &pj;
-                    pair.diff = v;
-                    pair.length_sq = length_sq;
-                    pair.length = sqrt(length_sq);
-                    pairs.push_back(pair);
-                }
-            }
-        };
-    };
-
-
     void update_pairs() {
-        const vector_type diag = Traits::diag_vector();
-
-        HashTable ht(particles_);
         pairs_.clear();
+        neighbor_search_.foreach_candidate(
+            int(particles_.size()),
+            [this](int i) -> const vector_type& {
+                return particles_[i].position;
+            },
+            [this](int i, int j) {
+                add_pair(particles_[i], particles_[j]);
+            });
+    }
 
-        for (Particle& p: particles_) {
-            int coords[2][Traits::DIMENSION];
-            Traits::make_coords(coords[0], p.position - diag);
-            Traits::make_coords(coords[1], p.position + diag);
-
-            int c[Traits::DIMENSION];
-            typename
-                update_pairs_n<Traits::DIMENSION>::
-                when_n<Traits::DIMENSION>::exec(
-                    p, ht, coords, c, pairs_);
-        }
+    void add_pair(Particle& pi, Particle& pj) {
+        vector_type v = pj.position - pi.position;
+        real_type length_sq = Traits::length_sq(v);
+        if (real_type(1.0) <= length_sq) { return; }
+
+        Pair pair;
+        pair.car = &pi;
+        pair.cdr = &pj;
+        pair.diff = v;
+        pair.length_sq = length_sq;
+        pair.length = sqrt(length_sq);
+        pairs_.push_back(pair);
     }
 
-    float square(float x) { return x * x; }
+public:
+    // cdro(car͋tɓ)
+    // diffcarcdrցAlength_sqƂƂɒTa1ƂP
+    // (sph::sphhybridłg)
+    static vector_type repulsion(
+        const vector_type& diff, real_type length_sq, real_type k) {
+        real_type x = real_type(1.0) - length_sq;
+        return diff * (x * x * k);
+    }
 
 private:
     std::vector<Particle>   particles_;
     std::vector<Pair>       pairs_;
     real_type               src_search_radius_;
+    NeighborSearch<Traits>  neighbor_search_;
 
 };
 
-} // namespace sph
+} // namespace cloud
 
 struct cloud_traits_D3DX_2D {
     typedef float  real_type;
@@ -224,9 +176,6 @@ struct cloud_traits_D3DX_2D {
     static vector_type zero_vector() {
         return vector_type(0.0f, 0.0f);
     }
-    static vector_type diag_vector() {
-        return vector_type(1.0f, 1.0f);
-    }
     static real_type length(const vector_type& v) {
         return D3DXVec2Length(&v);
     }
@@ -235,7 +184,7 @@ struct cloud_traits_D3DX_2D {
     }
 
     static int coord(real_type n) {
-        return int(floor(n));
+        return neighbor_search_coord(n);
     }
     static void make_coords(int a[2], const vector_type& v) {
         a[0] = coord(v.x);
@@ -245,14 +194,7 @@ struct cloud_traits_D3DX_2D {
         v.x = a[0];
         v.y = a[1];
     }
-    static int hash(const int a[2], int table_size) {
-        // large prime numbers
-        const int p1 = 73856093;
-        const int p2 = 19349663;
-
-        return size_t((a[0] * p1)^(a[1] * p2))% table_size;
-    }
 
 };
 
-#endif // SPH_HPP_
+#endif // CLOUD_HPP_
@@ -1,82 +1,434 @@
 // 2016/03/19 Naoyuki Hirayama
 
 #include "gci.hpp"
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
 
 namespace gci {
 
-void read_gci(const char* filename, Document& doc) {
-    std::ifstream ifs(filename);
+namespace {
+
+const char GCB_MAGIC[4] = { 'G', 'C', 'B', '\0' };
+const boost::uint32_t GCB_VERSION = 1;
+const boost::uint32_t GCB_BYTE_ORDER = 0x01020304;
+
+// ZNV擪̃ACg
+const size_t GCB_ALIGNMENT = 16;
+
+enum Section {
+    Vertices,               // D3DXVECTOR2
+    Sites,                  // Document::Site
+    PolygonOffsets,         // int(|S+1)
+    PolygonIndices,         // int
+    CellSiteIndices,        // int
+    CellVertexOffsets,      // int(Z+1)
+    CellVertexIndices,      // int
+    CellTriangleOffsets,    // int(Z+1)
+    CellTriangles,          // Document::Triangle
+    SECTION_COUNT
+};
+
+struct SectionEntry {
+    boost::uint32_t offset;
+    boost::uint32_t count;
+    boost::uint32_t element_size;
+};
+
+struct Header {
+    char            magic[4];
+    boost::uint32_t version;
+    boost::uint32_t byte_order;
+    SectionEntry    sections[SECTION_COUNT];
+};
+
+size_t align_up(size_t n) {
+    return (n + GCB_ALIGNMENT - 1) & ~(GCB_ALIGNMENT - 1);
+}
+
+struct SectionData {
+    SectionData() : p(nullptr), count(0), element_size(0) {}
+
+    template <class T>
+    void set(const std::vector<T>& v) {
+        p = v.empty() ? nullptr : &v[0];
+        count = v.size();
+        element_size = sizeof(T);
+    }
+
+    const void* p;
+    size_t      count;
+    size_t      element_size;
+};
+
+template <class T>
+ArrayView<T> get_section(const MappedFile& file, Section s) {
+    const SectionEntry& e = ((const Header*)file.data())->sections[s];
+    return ArrayView<T>((const T*)(file.data() + e.offset), e.count);
+}
+
+// ItZbgzcount+1ŒPAŌオpool̑傫Ɉv邩
+bool check_offsets(const ArrayView<int>& offsets, size_t pool_size) {
+    if (offsets.empty() || offsets[0] != 0) { return false; }
+    for (size_t i = 1 ; i < offsets.size() ; i++) {
+        if (offsets[i] < offsets[i-1]) { return false; }
+    }
+    return size_t(offsets.back()) == pool_size;
+}
+
+// 󔒋؂̐l擪珇ɓǂ
+// (ifstream >>肸ƑBt@CŜǂł'\0'ŏI[)
+class Tokenizer {
+public:
+    Tokenizer(const char* filename) : opened_(false), failed_(false) {
+        std::ifstream ifs(filename, std::ios::binary);
+        if (ifs) {
+            opened_ = true;
+            ifs.seekg(0, std::ios::end);
+            buffer_.resize(size_t(ifs.tellg()));
+            ifs.seekg(0, std::ios::beg);
+            if (!buffer_.empty()) {
+                ifs.read(&buffer_[0], buffer_.size());
+            }
+        }
+        buffer_.push_back('\0');
+        p_ = &buffer_[0];
+    }
+
+    bool is_open() const { return opened_; }
+
+    // lłȂƂǂƂ痧
+    bool failed() const { return failed_; }
+
+    int next_int() {
+        char* e;
+        int n = int(strtol(p_, &e, 10));
+        if (e == p_) { failed_ = true; }
+        p_ = e;
+        return n;
+    }
+
+    float next_float() {
+        char* e;
+        float x = strtof(p_, &e);
+        if (e == p_) { failed_ = true; }
+        p_ = e;
+        return x;
+    }
+
+    // vf
+    // ̂ƂƎc̕葽Ƃ(vf͍Œ2)
+    // failedɂ0Ԃ(ꂽt@CŋresizeȂ)
+    int next_count() {
+        int c = next_int();
+        if (c < 0 || size_t(&buffer_.back() - p_) < size_t(c)) {
+            failed_ = true;
+            return 0;
+        }
+        return c;
+    }
+
+    // c̐v̌ɑ
+    void read_ints(std::vector<int>& v, int c) {
+        size_t n = v.size();
+        v.resize(n + c);
+        for (int i = 0 ; i < c ; i++) {
+            v[n + i] = next_int();
+        }
+    }
+
+private:
+    std::vector<char>   buffer_;
+    char*               p_;
+    bool                opened_;
+    bool                failed_;
+
+};
+
+bool check_indices(const ArrayView<int>& indices, size_t limit) {
+    for (int i: indices) {
+        if (i < 0 || limit <= size_t(i)) { return false; }
+    }
+    return true;
+}
+
+// ŃANZT͈͊Oǂ܂Ȃ悤Ɉʂ茟
+// (read_gciMappedDocument::openŋ)
+bool check_document(
+    const ArrayView<D3DXVECTOR2>& vertices,
+    const ArrayView<Document::Site>& sites,
+    const ArrayView<int>& polygon_offsets,
+    const ArrayView<int>& polygon_indices,
+    const ArrayView<int>& cell_site_indices,
+    const ArrayView<int>& cell_vertex_offsets,
+    const ArrayView<int>& cell_vertex_indices,
+    const ArrayView<int>& cell_triangle_offsets,
+    const ArrayView<Document::Triangle>& cell_triangles) {
+    bool valid =
+        check_offsets(polygon_offsets, polygon_indices.size()) &&
+        check_offsets(cell_vertex_offsets, cell_vertex_indices.size()) &&
+        check_offsets(cell_triangle_offsets, cell_triangles.size()) &&
+        cell_vertex_offsets.size() == cell_site_indices.size() + 1 &&
+        cell_triangle_offsets.size() == cell_site_indices.size() + 1 &&
+        check_indices(polygon_indices, vertices.size()) &&
+        check_indices(cell_vertex_indices, vertices.size()) &&
+        check_indices(cell_site_indices, sites.size()) &&
+        check_indices(
+            ArrayView<int>(
+                (const int*)cell_triangles.data(),
+                cell_triangles.size() * 3),
+            vertices.size());
+    for (const Document::Site& s: sites) {
+        if (!valid) { break; }
+        valid = 0 <= s.p0 && size_t(s.p0) < vertices.size() &&
+            (!s.is_segment ||
+             (0 <= s.p1 && size_t(s.p1) < vertices.size()));
+    }
+    return valid;
+}
+
+}
+
+//****************************************************************
+// Document
+void Document::clear() {
+    vertices_.clear();
+    sites_.clear();
+    polygon_offsets_.assign(1, 0);
+    polygon_indices_.clear();
+    cell_site_indices_.clear();
+    cell_vertex_offsets_.assign(1, 0);
+    cell_vertex_indices_.clear();
+    cell_triangle_offsets_.assign(1, 0);
+    cell_triangles_.clear();
+}
+
+//****************************************************************
+// read_gci
+bool read_gci(const char* filename, Document& doc) {
+    Tokenizer t(filename);
+    doc.clear();
+    if (!t.is_open()) { return false; }
 
     // _Xg
-    int vertex_count;
-    ifs >> vertex_count;
+    int vertex_count = t.next_count();
+    doc.vertices_.resize(vertex_count);
     for (int i = 0 ; i <vertex_count ; i++) {
-        int id;
-        float x, y;
-        ifs >> id >> x >> y;
-        doc.vertices.push_back(D3DXVECTOR2(x, y));
+        t.next_int(); // id
+        float x = t.next_float();
+        float y = t.next_float();
+        doc.vertices_[i] = D3DXVECTOR2(x, y);
     }
 
     // ̓|S
-    int input_polygon_count;
-    ifs >> input_polygon_count;
+    int input_polygon_count = t.next_count();
+    doc.polygon_offsets_.resize(input_polygon_count + 1);
     for (int i = 0 ; i <input_polygon_count ; i++) {
-        int id, c;
-        ifs >> id >> c;
-        std::vector<int> p;
-        for (int j = 0 ; j <c ; j++) {
-            int index;
-            ifs >> index;
-            p.push_back(index);
-        }
-        doc.input_polygons.push_back(p);
+        t.next_int(); // id
+        int c = t.next_count();
+        t.read_ints(doc.polygon_indices_, c);
+        doc.polygon_offsets_[i+1] = int(doc.polygon_indices_.size());
     }
 
     // ̓TCg
-    int input_site_count;
-    ifs >> input_site_count;
+    int input_site_count = t.next_count();
+    doc.sites_.resize(input_site_count);
     for (int i = 0 ; i <input_site_count ; i++) {
-        int id, type;
-        ifs >> id >> type;
-        Document::Site s;
+        t.next_int(); // id
+        int type = t.next_int();
+        Document::Site& s = doc.sites_[i];
         if (type == 1) {
-            s.is_segment = false;
-            ifs >> s.p0;
+            s.is_segment = 0;
+            s.p0 = t.next_int();
+            s.p1 = -1;
+        } else if (type == 2) {
+            s.is_segment = 1;
+            s.p0 = t.next_int();
+            s.p1 = t.next_int();
         } else {
-            assert(type == 2);
-            s.is_segment = true;
-            ifs >> s.p0 >> s.p1;
+            doc.clear();
+            return false;
         }
-        doc.sites.push_back(s);
     }
 
     // {mCZEOp`
-    int voronoi_cell_count;
-    ifs >> voronoi_cell_count;
+    int voronoi_cell_count = t.next_count();
+    doc.cell_site_indices_.resize(voronoi_cell_count);
+    doc.cell_vertex_offsets_.resize(voronoi_cell_count + 1);
+    doc.cell_triangle_offsets_.resize(voronoi_cell_count + 1);
     for (int i = 0 ; i <voronoi_cell_count ; i++) {
-        Document::Cell cell;
-        int id;
-        ifs >> id >> cell.site_index;
+        t.next_int(); // id
+        doc.cell_site_indices_[i] = t.next_int();
+
+        int c = t.next_count();
+        t.read_ints(doc.cell_vertex_indices_, c);
+        doc.cell_vertex_offsets_[i+1] = int(doc.cell_vertex_indices_.size());
 
-        int c;
-        ifs >> c;
+        c = t.next_count();
+        size_t n = doc.cell_triangles_.size();
+        doc.cell_triangles_.resize(n + c);
         for (int j = 0 ; j <c ; j++) {
-            int index;
-            ifs >> index;
-            cell.vertex_indices.push_back(index);
+            Document::Triangle& tr = doc.cell_triangles_[n + j];
+            tr.v0 = t.next_int();
+            tr.v1 = t.next_int();
+            tr.v2 = t.next_int();
         }
+        doc.cell_triangle_offsets_[i+1] = int(doc.cell_triangles_.size());
+    }
 
-        ifs >> c;
-        for (int j = 0 ; j <c ; j++) {
-            Document::Triangle t;
-            ifs >> t.v0 >> t.v1 >> t.v2;
-            cell.triangles.push_back(t);
+    if (t.failed() ||
+        !check_document(
+            doc.vertices_,
+            doc.sites_,
+            doc.polygon_offsets_,
+            doc.polygon_indices_,
+            doc.cell_site_indices_,
+            doc.cell_vertex_offsets_,
+            doc.cell_vertex_indices_,
+            doc.cell_triangle_offsets_,
+            doc.cell_triangles_)) {
+        doc.clear();
+        return false;
+    }
+    return true;
+}
+
+//****************************************************************
+// write_gcb
+bool write_gcb(const char* filename, const Document& doc) {
+    SectionData sections[SECTION_COUNT];
+    sections[Vertices].set(doc.vertices_);
+    sections[Sites].set(doc.sites_);
+    sections[PolygonOffsets].set(doc.polygon_offsets_);
+    sections[PolygonIndices].set(doc.polygon_indices_);
+    sections[CellSiteIndices].set(doc.cell_site_indices_);
+    sections[CellVertexOffsets].set(doc.cell_vertex_offsets_);
+    sections[CellVertexIndices].set(doc.cell_vertex_indices_);
+    sections[CellTriangleOffsets].set(doc.cell_triangle_offsets_);
+    sections[CellTriangles].set(doc.cell_triangles_);
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, GCB_MAGIC, 4);
+    h.version = GCB_VERSION;
+    h.byte_order = GCB_BYTE_ORDER;
+
+    size_t offset = align_up(sizeof(Header));
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        h.sections[i].offset = boost::uint32_t(offset);
+        h.sections[i].count = boost::uint32_t(sections[i].count);
+        h.sections[i].element_size =
+            boost::uint32_t(sections[i].element_size);
+        offset = align_up(
+            offset + sections[i].count * sections[i].element_size);
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) { return false; }
+
+    static const char padding[GCB_ALIGNMENT] = { 0 };
+    ofs.write((const char*)&h, sizeof(h));
+    size_t written = sizeof(h);
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        size_t size = sections[i].count * sections[i].element_size;
+        ofs.write(padding, h.sections[i].offset - written);
+        if (size != 0) {
+            ofs.write((const char*)sections[i].p, size);
         }
+        written = h.sections[i].offset + size;
+    }
+
+    return bool(ofs);
+}
+
+/*============================================================================
+ *
+ * class MappedDocument 
+ *
+ * 
+ *
+ *==========================================================================*/
+//<<<<<<<<<< MappedDocument
+
+//****************************************************************
+// open
+bool MappedDocument::open(const char* filename) {
+    close();
+    if (!file_.open(filename)) { return false; }
+
+    static const size_t element_sizes[SECTION_COUNT] = {
+        sizeof(D3DXVECTOR2),
+        sizeof(Site),
+        sizeof(int),
+        sizeof(int),
+        sizeof(int),
+        sizeof(int),
+        sizeof(int),
+        sizeof(int),
+        sizeof(Triangle),
+    };
 
-        doc.voronoi_cells.push_back(cell);
+    const Header* h = (const Header*)file_.data();
+    if (file_.size() < sizeof(Header) ||
+        memcmp(h->magic, GCB_MAGIC, 4) != 0 ||
+        h->version != GCB_VERSION ||
+        h->byte_order != GCB_BYTE_ORDER) {
+        close();
+        return false;
     }
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        const SectionEntry& e = h->sections[i];
+        if (e.element_size != element_sizes[i] ||
+            e.offset % GCB_ALIGNMENT != 0 ||
+            file_.size() <
+            size_t(e.offset) + size_t(e.count) * e.element_size) {
+            close();
+            return false;
+        }
+    }
+
+    vertices_ = get_section<D3DXVECTOR2>(file_, Vertices);
+    sites_ = get_section<Site>(file_, Sites);
+    polygon_offsets_ = get_section<int>(file_, PolygonOffsets);
+    polygon_indices_ = get_section<int>(file_, PolygonIndices);
+    cell_site_indices_ = get_section<int>(file_, CellSiteIndices);
+    cell_vertex_offsets_ = get_section<int>(file_, CellVertexOffsets);
+    cell_vertex_indices_ = get_section<int>(file_, CellVertexIndices);
+    cell_triangle_offsets_ = get_section<int>(file_, CellTriangleOffsets);
+    cell_triangles_ = get_section<Triangle>(file_, CellTriangles);
+
+    if (!check_document(
+            vertices_,
+            sites_,
+            polygon_offsets_,
+            polygon_indices_,
+            cell_site_indices_,
+            cell_vertex_offsets_,
+            cell_vertex_indices_,
+            cell_triangle_offsets_,
+            cell_triangles_)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
 
-    dprintf("");
+//****************************************************************
+// close
+void MappedDocument::close() {
+    file_.close();
+    vertices_ = ArrayView<D3DXVECTOR2>();
+    sites_ = ArrayView<Site>();
+    polygon_offsets_ = ArrayView<int>();
+    polygon_indices_ = ArrayView<int>();
+    cell_site_indices_ = ArrayView<int>();
+    cell_vertex_offsets_ = ArrayView<int>();
+    cell_vertex_indices_ = ArrayView<int>();
+    cell_triangle_offsets_ = ArrayView<int>();
+    cell_triangles_ = ArrayView<Triangle>();
 }
 
+//>>>>>>>>>> MappedDocument
+
 } // namespace gci
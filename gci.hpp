@@ -11,33 +11,139 @@
 #define GCI_HPP_
 
 #include <vector>
+#include "array_view.hpp"
+#include "mapped_file.hpp"
 
 namespace gci {
 
-struct Document {
+// ϒ̗(̓|SEZ̒_EOp`)͎ނƂ
+// count+1̃ItZbgz1{̃CfbNXzŎ(CSR)
+class Document {
+public:
     struct Site {
-        bool is_segment;
-        int  p0;
-        int  p1;
+        int is_segment; // 0 or 1(.gcbɂ̂܂܍ڂ̂boolɂȂ)
+        int p0;
+        int p1;
     };
     struct Triangle {
         int v0;
         int v1;
         int v2;
     };
-    struct Cell {
-        int                     site_index;
-        std::vector<int>        vertex_indices;
-        std::vector<Triangle>   triangles;
-    };
 
-    std::vector<D3DXVECTOR2>        vertices;
-    std::vector<Site>               sites;
-    std::vector<std::vector<int>>   input_polygons;
-    std::vector<Cell>               voronoi_cells;
+public:
+    Document() { clear(); }
+
+    void clear();
+
+    // MappedDocumentƋʂ̃ANZT
+    ArrayView<D3DXVECTOR2> vertex_array() const { return vertices_; }
+    ArrayView<Site> site_array() const { return sites_; }
+
+    size_t input_polygon_count() const {
+        return polygon_offsets_.size() - 1;
+    }
+    ArrayView<int> input_polygon(size_t i) const {
+        return slice(polygon_indices_, polygon_offsets_, i);
+    }
+
+    size_t cell_count() const { return cell_site_indices_.size(); }
+    int cell_site_index(size_t i) const { return cell_site_indices_[i]; }
+    ArrayView<int> cell_vertex_indices(size_t i) const {
+        return slice(cell_vertex_indices_, cell_vertex_offsets_, i);
+    }
+    ArrayView<Triangle> cell_triangles(size_t i) const {
+        return slice(cell_triangles_, cell_triangle_offsets_, i);
+    }
+
+private:
+    template <class T>
+    static ArrayView<T> slice(
+        const std::vector<T>& a, const std::vector<int>& offsets, size_t i) {
+        const T* p = a.empty() ? nullptr : &a[0];
+        return ArrayView<T>(p + offsets[i], p + offsets[i+1]);
+    }
+
+    friend bool read_gci(const char* filename, Document& doc);
+    friend bool write_gcb(const char* filename, const Document& doc);
+
+private:
+    std::vector<D3DXVECTOR2>    vertices_;
+    std::vector<Site>           sites_;
+    std::vector<int>            polygon_offsets_;
+    std::vector<int>            polygon_indices_;
+    std::vector<int>            cell_site_indices_;
+    std::vector<int>            cell_vertex_offsets_;
+    std::vector<int>            cell_vertex_indices_;
+    std::vector<int>            cell_triangle_offsets_;
+    std::vector<Triangle>       cell_triangles_;
+
 };
 
-void read_gci(const char* filename, Document& doc);
+// JȂElȂE͈͊O̔ԍƂ
+// docɂfalse
+bool read_gci(const char* filename, Document& doc);
+
+// oCi`(.gcb)
+// gGfBAAwb_̃ZNV\̌
+// Document̔z񂪂̂܂ܕ
+bool write_gcb(const char* filename, const Document& doc);
+
+// .gcbmmapăRs[Ɍ
+class MappedDocument : boost::noncopyable {
+public:
+    typedef Document::Site      Site;
+    typedef Document::Triangle  Triangle;
+
+public:
+    MappedDocument() {}
+    ~MappedDocument() {}
+
+    // `Eo[WE͈͂sȂfalse
+    bool open(const char* filename);
+    void close();
+    bool is_open() const { return file_.is_open(); }
+
+    ArrayView<D3DXVECTOR2> vertex_array() const { return vertices_; }
+    ArrayView<Site> site_array() const { return sites_; }
+
+    // JĂȂ0(ItZbgz񂪋)
+    size_t input_polygon_count() const {
+        return polygon_offsets_.empty() ? 0 : polygon_offsets_.size() - 1;
+    }
+    ArrayView<int> input_polygon(size_t i) const {
+        return slice(polygon_indices_, polygon_offsets_, i);
+    }
+
+    size_t cell_count() const { return cell_site_indices_.size(); }
+    int cell_site_index(size_t i) const { return cell_site_indices_[i]; }
+    ArrayView<int> cell_vertex_indices(size_t i) const {
+        return slice(cell_vertex_indices_, cell_vertex_offsets_, i);
+    }
+    ArrayView<Triangle> cell_triangles(size_t i) const {
+        return slice(cell_triangles_, cell_triangle_offsets_, i);
+    }
+
+private:
+    template <class T>
+    static ArrayView<T> slice(
+        const ArrayView<T>& a, const ArrayView<int>& offsets, size_t i) {
+        return ArrayView<T>(a.data() + offsets[i], a.data() + offsets[i+1]);
+    }
+
+private:
+    MappedFile              file_;
+    ArrayView<D3DXVECTOR2>  vertices_;
+    ArrayView<Site>         sites_;
+    ArrayView<int>          polygon_offsets_;
+    ArrayView<int>          polygon_indices_;
+    ArrayView<int>          cell_site_indices_;
+    ArrayView<int>          cell_vertex_offsets_;
+    ArrayView<int>          cell_vertex_indices_;
+    ArrayView<int>          cell_triangle_offsets_;
+    ArrayView<Triangle>     cell_triangles_;
+
+};
 
 }
 
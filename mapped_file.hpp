@@ -0,0 +1,69 @@
+// 2026/10/19
+
+/*!
+	@file	  mapped_file.hpp
+	@brief	  <Tv>
+
+	ǂݎp̃}bvgt@C
+*/
+
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <boost/utility.hpp>
+
+class MappedFile : boost::noncopyable {
+public:
+    MappedFile()
+        : file_(INVALID_HANDLE_VALUE), mapping_(NULL), view_(NULL), size_(0) {
+    }
+    ~MappedFile() { close(); }
+
+    bool open(const char* filename) {
+        close();
+
+        file_ = CreateFileA(
+            filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) { return false; }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+            // t@C̓}bvłȂ
+            close();
+            return false;
+        }
+        size_ = size_t(size.QuadPart);
+
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping_) { close(); return false; }
+
+        view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (!view_) { close(); return false; }
+
+        return true;
+    }
+
+    void close() {
+        if (view_) { UnmapViewOfFile(view_); view_ = NULL; }
+        if (mapping_) { CloseHandle(mapping_); mapping_ = NULL; }
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+        }
+        size_ = 0;
+    }
+
+    bool is_open() const { return view_ != NULL; }
+    const char* data() const { return (const char*)view_; }
+    size_t size() const { return size_; }
+
+private:
+    HANDLE  file_;
+    HANDLE  mapping_;
+    void*   view_;
+    size_t  size_;
+
+};
+
+#endif // MAPPED_FILE_HPP_
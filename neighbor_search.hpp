@@ -0,0 +1,218 @@
+// 2026/10/19
+
+/*!
+	@file	  neighbor_search.hpp
+	@brief	  <Tv>
+
+	sph::sphcloud::cloudŋLߖTT
+	Ta1ɐKʒuZԍŃ\[giqɓA
+	ZƗׂ̃Z(half-shell)̗q̑g1񂸂񋓂
+	Traitsɂvector_typeADIMENSIONAmake_coordsv
+	make_coordsneighbor_search_coordŃZWɂ
+*/
+
+#ifndef NEIGHBOR_SEARCH_HPP_
+#define NEIGHBOR_SEARCH_HPP_
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <boost/cstdint.hpp>
+#include "radix_sort.hpp"
+
+// Kʒu1ZWɂ
+// NaN≓ĺ}NEIGHBOR_SEARCH_COORD_LIMITɊ񂹂
+// (intւ̕ϊƁAZ͈̔͂̐ςboost::uint64_tɎ܂悤)
+const int NEIGHBOR_SEARCH_COORD_LIMIT = 1 << 20;
+
+template <class T>
+inline int neighbor_search_coord(T n) {
+    const T limit = T(NEIGHBOR_SEARCH_COORD_LIMIT);
+    if (!(-limit < n)) { return -NEIGHBOR_SEARCH_COORD_LIMIT; }
+    if (!(n < limit)) { return NEIGHBOR_SEARCH_COORD_LIMIT; }
+    return int(std::floor(n));
+}
+
+template <class Traits>
+class NeighborSearch {
+private:
+    typedef typename Traits::vector_type    vector_type;
+
+    enum { D = Traits::DIMENSION };
+
+    // W̕2 * NEIGHBOR_SEARCH_COORD_LIMIT + 1 (22bit)܂
+    static_assert(D * 22 <= 64, "cell key does not fit in 64 bits");
+
+    // Z(傫͐KTa1)
+    // particles_[begin, end)̃Z̗q
+    struct Cell {
+        boost::uint64_t key;
+        int             begin;
+        int             end;
+    };
+
+    struct CellEntry {
+        boost::uint64_t key;
+        int             index;
+    };
+
+    // Zq̂̔{ȉȂcell_table_g
+    enum { CELL_TABLE_RATIO = 16 };
+
+public:
+    NeighborSearch() {}
+    ~NeighborSearch() {}
+
+    // n̗q̋߂Ȃg(Zׂ̃Z)f(i, j)ɓn
+    // position(i)͐KʒuAfŒׂ
+    // Z͗qԍAZԂhalf-shell̏ŁA͖񓯂
+    template <class P, class F>
+    void foreach_candidate(int n, P position, F f) {
+        cells_.clear();
+        if (n == 0) { return; }
+
+        // ZWƔ͈
+        coords_.resize(n * D);
+        for (int i = 0 ; i < n ; i++) {
+            int* c = &coords_[i * D];
+            Traits::make_coords(c, position(i));
+            for (int d = 0 ; d < D ; d++) {
+                if (i == 0 || c[d] < lo_[d]) { lo_[d] = c[d]; }
+                if (i == 0 || hi_[d] < c[d]) { hi_[d] = c[d]; }
+            }
+        }
+
+        // ZԍŃ\[g(Ȃ̂ŃZ͗qԍ)
+        boost::uint64_t volume = 1;
+        for (int d = 0 ; d < D ; d++) {
+            extent_[d] = boost::uint64_t(
+                boost::int64_t(hi_[d]) - boost::int64_t(lo_[d])) + 1;
+            volume *= extent_[d];
+        }
+        int key_bits = 0;
+        while (key_bits < 64 && (volume - 1) >> key_bits) { key_bits++; }
+        entries_.resize(n);
+        for (int i = 0 ; i < n ; i++) {
+            entries_[i].key = cell_key(&coords_[i * D]);
+            entries_[i].index = i;
+        }
+        radix_sort(entries_, entries_tmp_, key_bits);
+
+        particles_.resize(n);
+        for (int i = 0 ; i < n ; i++) {
+            const CellEntry& e = entries_[i];
+            if (cells_.empty() || cells_.back().key != e.key) {
+                Cell cell;
+                cell.key = e.key;
+                cell.begin = i;
+                cells_.push_back(cell);
+            }
+            cells_.back().end = i + 1;
+            particles_[i] = e.index;
+        }
+
+        // ql܂Ă΃L[璼ڈ\
+        // (܂΂ȂƂcells_񕪒T)
+        cell_table_.clear();
+        if (volume <= boost::uint64_t(n) * CELL_TABLE_RATIO) {
+            cell_table_.assign(size_t(volume), -1);
+            for (size_t i = 0 ; i < cells_.size() ; i++) {
+                cell_table_[size_t(cells_[i].key)] = int(i);
+            }
+        }
+
+        // Z͔ԍAZԂhalf-shell̑Ƃ
+        const std::vector<std::array<int, D>>& offsets = half_shell();
+        for (const Cell& a: cells_) {
+            for (int i = a.begin ; i < a.end ; i++) {
+                for (int j = i + 1 ; j < a.end ; j++) {
+                    f(particles_[i], particles_[j]);
+                }
+            }
+
+            const int* ca = &coords_[particles_[a.begin] * D];
+            for (const std::array<int, D>& o: offsets) {
+                int cb[D];
+                bool inside = true;
+                for (int d = 0 ; d < D ; d++) {
+                    cb[d] = ca[d] + o[d];
+                    inside = inside && lo_[d] <= cb[d] && cb[d] <= hi_[d];
+                }
+                if (!inside) { continue; }
+
+                const Cell* b = find_cell(cell_key(cb));
+                if (!b) { continue; }
+                for (int i = a.begin ; i < a.end ; i++) {
+                    int pi = particles_[i];
+                    for (int j = b->begin ; j < b->end ; j++) {
+                        f(pi, particles_[j]);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    // half-shell stencil
+    // ŐɂȂItZbg((3^D - 1) / 2)
+    // Z̑g傤1񂸂
+    static const std::vector<std::array<int, D>>& half_shell() {
+        static std::vector<std::array<int, D>> offsets;
+        if (offsets.empty()) {
+            int total = 1;
+            for (int d = 0 ; d < D ; d++) { total *= 3; }
+            for (int t = 0 ; t < total ; t++) {
+                std::array<int, D> o;
+                int x = t;
+                for (int d = 0 ; d < D ; d++) {
+                    o[d] = x % 3 - 1;
+                    x /= 3;
+                }
+                int d = 0;
+                while (d < D && o[d] == 0) { d++; }
+                if (d < D && 0 < o[d]) {
+                    offsets.push_back(o);
+                }
+            }
+        }
+        return offsets;
+    }
+
+    boost::uint64_t cell_key(const int* c) const {
+        boost::uint64_t key = 0;
+        for (int d = D - 1 ; 0 <= d ; d--) {
+            key = key * extent_[d] + boost::uint64_t(c[d] - lo_[d]);
+        }
+        return key;
+    }
+
+    const Cell* find_cell(boost::uint64_t key) const {
+        if (!cell_table_.empty()) {
+            int i = cell_table_[size_t(key)];
+            return i < 0 ? nullptr : &cells_[i];
+        }
+
+        typename std::vector<Cell>::const_iterator i =
+            std::lower_bound(
+                cells_.begin(), cells_.end(), key,
+                [](const Cell& c, boost::uint64_t k) { return c.key < k; });
+        if (i == cells_.end() || i->key != key) { return nullptr; }
+        return &*i;
+    }
+
+private:
+    int                     lo_[D];
+    int                     hi_[D];
+    boost::uint64_t         extent_[D];
+
+    std::vector<int>        coords_;    // qƂD
+    std::vector<CellEntry>  entries_;
+    std::vector<CellEntry>  entries_tmp_;
+    std::vector<Cell>       cells_;
+    std::vector<int>        particles_; // Zɕׂqԍ
+    std::vector<int>        cell_table_;    // L[ -> cells_̔ԍ
+
+};
+
+#endif // NEIGHBOR_SEARCH_HPP_
@@ -18,6 +18,7 @@
 #include "board.hpp"
 #include "board_renderer.hpp"
 #include "gci.hpp"
+#include "bench.hpp"
 #include "player.hpp"
 #include "ai.hpp"
 
@@ -52,7 +53,7 @@ public:
 public:
     void accept(zw::win::event::create& m) {
         window_user_type::accept(m);
-        board_.setup();
+        board_.start_setup(); // n`̓[J[œǂ
         board_renderer_.setup();
         font_vault.setup(d3d.device());
     }
@@ -69,7 +70,7 @@ public:
         window_user_type::accept(m);
 
         if (m.lbutton) {
-            if (!dragging_) {
+            if (!dragging_ && board_.ready()) {
                 dragging_ = true;
                 player_.tap(Vector(m.position.dx(), m.position.dy()));
             }
@@ -82,10 +83,45 @@ public:
         if (m.code == VK_ESCAPE) {
             auto_update_ = !auto_update_;
         }
+
+        // fobOp: ł͎gȂWater̃[h؂ւ
+        Water& water = board_.water();
+        switch (m.code) {
+            case 'a':
+                water.set_step_mode(
+                    water.get_step_mode() == Water::STEP_FIXED ?
+                    Water::STEP_ADAPTIVE : Water::STEP_FIXED);
+                break;
+            case 'm':
+                water.set_max_time_level(
+                    water.get_max_time_level() == 0 ? MAX_TIME_LEVEL : 0);
+                break;
+            case 'p': {
+                typedef sph::sph<WaterTraits> SPH;
+                water.set_solver(
+                    water.get_solver() == SPH::SOLVER_DOUBLE_DENSITY ?
+                    SPH::SOLVER_PBF : SPH::SOLVER_DOUBLE_DENSITY);
+                break;
+            }
+            case 'l':
+                water.set_lod(!water.get_lod());
+                break;
+            case 'h':
+                water.set_hybrid(!water.get_hybrid());
+                break;
+            default:
+                break;
+        }
     }
 
     void on_timer(int elapsed0, float elapsed1) {
         d3d_user::on_timer(elapsed0, elapsed1);
+        if (!board_.ready()) {
+            // ǂݍݒ̓Cto[Őio
+            board_.poll_setup();
+            life_bar_.set_value(board_.load_progress());
+            return;
+        }
         if (auto_update_ || click_) {
             board_.update(elapsed1);
             ai_.think(elapsed1);
@@ -133,6 +169,21 @@ int PASCAL WinMain(HINSTANCE hInstance,
                    LPSTR lpCmdLine,
                    int nCmdShow) 
 {
+    // .gci(eLXg).gcb(oCi)̕ϊďI
+    // pasta.exe -gci2gcb data/cave.gci data/cave.gcb
+    if (__argc == 4 && strcmp(__argv[1], "-gci2gcb") == 0) {
+        gci::Document doc;
+        if (!gci::read_gci(__argv[2], doc)) { return 1; }
+        return gci::write_gcb(__argv[3], doc) ? 0 : 1;
+    }
+
+    // vEďI(ʂ͏o̓t@Cɏ)
+    // pasta.exe -bench terrain_map bench.txt [data/cave.gci]
+    if ((__argc == 4 || __argc == 5) && strcmp(__argv[1], "-bench") == 0) {
+        return run_bench(
+            __argv[2], __argv[3], __argc == 5 ? __argv[4] : TERRAIN_FILENAME);
+    }
+
     application a;
     a.run();
     return 0;
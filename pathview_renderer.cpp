@@ -1,6 +1,7 @@
 // 2009/01/29 Naoyuki Hirayama
 
 #include "pathview_renderer.hpp"
+#include <algorithm>
 
 const int BEZIER_DIVISION = 8;
 const int DOT_DIVISION = 32;
@@ -20,6 +21,34 @@ void PathviewRenderer::render(
     LPDIRECT3DDEVICE9               device,
     const std::vector<Primitive>&   primitives,
     int                             step) {
+    draw_primitives(primitives, step, lines_, triangles_);
+    cached_ = false;
+    draw_streams(device);
+}
+
+//****************************************************************
+// render
+void PathviewRenderer::render(
+    LPDIRECT3DDEVICE9               device,
+    const std::vector<Primitive>&   primitives,
+    int                             step,
+    unsigned int                    version) {
+    if (!cached_ ||
+        cached_primitives_ != &primitives ||
+        cached_version_ != version ||
+        cached_step_ != step) {
+        draw_primitives(primitives, step, lines_, triangles_);
+        cached_ = true;
+        cached_primitives_ = &primitives;
+        cached_version_ = version;
+        cached_step_ = step;
+    }
+    draw_streams(device);
+}
+
+//----------------------------------------------------------------
+// draw_streams
+void PathviewRenderer::draw_streams(LPDIRECT3DDEVICE9 device) {
     device->SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
     device->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
     device->SetRenderState(D3DRS_ZENABLE, D3DZB_FALSE);
@@ -32,20 +61,21 @@ void PathviewRenderer::render(
     device->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG1);
     device->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_DIFFUSE);
 
-    static vertex_type vertices0[32768*4];
-    static vertex_type vertices1[32768*4];
-    vertex_type* v0 = vertices0;
-    vertex_type* v1 = vertices1;
-    draw_primitives(primitives, step, v0, v1);
-
-    int n0 =(v0 - vertices0)/ 2;
-    int n1 =(v1 - vertices1)/ 3;
-
     device->SetFVF(vertex_type::format);
-    device->DrawPrimitiveUP(
-        D3DPT_TRIANGLELIST, n1, vertices1, sizeof(vertex_type));
-    device->DrawPrimitiveUP(
-        D3DPT_LINELIST, n0, vertices0, sizeof(vertex_type));
+
+    // ÂfoCXMaxPrimitiveCountɍ킹ĕĕ`
+    int n1 = int(triangles_.size())/ 3;
+    for (int i = 0 ; i < n1 ; i += MAX_PRIMITIVE_COUNT) {
+        device->DrawPrimitiveUP(
+            D3DPT_TRIANGLELIST, (std::min)(n1 - i, int(MAX_PRIMITIVE_COUNT)),
+            &triangles_[i * 3], sizeof(vertex_type));
+    }
+    int n0 = int(lines_.size())/ 2;
+    for (int i = 0 ; i < n0 ; i += MAX_PRIMITIVE_COUNT) {
+        device->DrawPrimitiveUP(
+            D3DPT_LINELIST, (std::min)(n0 - i, int(MAX_PRIMITIVE_COUNT)),
+            &lines_[i * 2], sizeof(vertex_type));
+    }
 }
 
 //----------------------------------------------------------------
@@ -53,11 +83,27 @@ void PathviewRenderer::render(
 void PathviewRenderer::draw_primitives(
     const std::vector<Primitive>&   primitives,
     int                             step,
-    vertex_type*&                   v0,
-    vertex_type*&                   v1) {
+    std::vector<vertex_type>&       lines,
+    std::vector<vertex_type>&       triangles) {
+
+    // Pʉ~(Dotp)
+    static float circle[DOT_DIVISION + 1][2];
+    static bool circle_ready = false;
+    if (!circle_ready) {
+        for (int i = 0 ; i <= DOT_DIVISION ; i++) {
+            float t =(1.0f / DOT_DIVISION)* i * D3DX_PI * 2.0f;
+            circle[i][0] = cosf(t);
+            circle[i][1] = sinf(t);
+        }
+        circle_ready = true;
+    }
+
+    lines.clear();
+    triangles.clear();
 
     D3DXVECTOR2 cursor(0, 0); 
     DWORD color = D3DCOLOR_ARGB(64, 0, 0, 0);
+    vertex_type v;
 
     for (int i = 0 ; i <int(primitives.size()) && i < step ; i++) {
         const Primitive& p = primitives[i];
@@ -75,43 +121,34 @@ void PathviewRenderer::draw_primitives(
                 cursor = vec2(a);
                 break;
             case Primitive::LineTo:
-                v0[0].p = vec4(cursor);
-                v0[0].c = color;
-                v0[1].p = vec4(vec2(a));
-                v0[1].c = color;
-                v0 += 2;
+                v.c = color;
+                v.p = vec4(cursor);
+                lines.push_back(v);
+                v.p = vec4(vec2(a));
+                lines.push_back(v);
                 cursor = vec2(a);
                 break;
             case Primitive::Triangle:
-                v1[0].p = vec4(cursor);
-                v1[0].c = color;
-                v1[1].p = vec4(vec2(a + 0));
-                v1[1].c = color;
-                v1[2].p = vec4(vec2(a + 2));
-                v1[2].c = color;
-                v1 += 3;
+                v.c = color;
+                v.p = vec4(cursor);
+                triangles.push_back(v);
+                v.p = vec4(vec2(a + 0));
+                triangles.push_back(v);
+                v.p = vec4(vec2(a + 2));
+                triangles.push_back(v);
                 break;
             case Primitive::Dot: {
 #if 1
                 float r = a[0];
                 D3DXVECTOR2 c = cursor;
+                v.c = color;
                 for (int i = 0 ; i <DOT_DIVISION ; i++) {
-                    float t0 =(1.0f / DOT_DIVISION)*(i);
-                    float t1 =(1.0f / DOT_DIVISION)*(i + 1);
-
-                    t0 *= D3DX_PI * 2.0f;
-                    t1 *= D3DX_PI * 2.0f;
-
-                    float x0 = cosf(t0)* r;
-                    float y0 = sinf(t0)* r;
-                    float x1 = cosf(t1)* r;
-                    float y1 = sinf(t1)* r;
-
-                    v0[0].p = vec4(c + D3DXVECTOR2(x0, y0));
-                    v0[0].c = color;
-                    v0[1].p = vec4(c + D3DXVECTOR2(x1, y1));
-                    v0[1].c = color;
-                    v0 += 2;
+                    v.p = vec4(c + D3DXVECTOR2(
+                                   circle[i][0] * r, circle[i][1] * r));
+                    lines.push_back(v);
+                    v.p = vec4(c + D3DXVECTOR2(
+                                   circle[i+1][0] * r, circle[i+1][1] * r));
+                    lines.push_back(v);
                 }
 #endif
                 break;
@@ -18,20 +18,31 @@ private:
     typedef zw::fvf::vertex< (D3DFVF_XYZRHW|D3DFVF_DIFFUSE) > vertex_type;
 
 public:
-    PathviewRenderer() {}
+    PathviewRenderer() : cached_(false) {}
     ~PathviewRenderer() {}
 
+    // 񒸓_蒼
     void render(
         LPDIRECT3DDEVICE9    device,
         const std::vector<Primitive>& primitives,
         int        step);
 
+    // primitivesversionstepOƓȂO̒_̂܂ܕ`
+    // primitivesĂяoversionς邱
+    void render(
+        LPDIRECT3DDEVICE9    device,
+        const std::vector<Primitive>& primitives,
+        int        step,
+        unsigned int   version);
+
 private:
     void draw_primitives(
         const std::vector<Primitive>& primitives,
         int        step,
-        vertex_type*&     v0,
-        vertex_type*&     v1);
+        std::vector<vertex_type>&  lines,
+        std::vector<vertex_type>&  triangles);
+
+    void draw_streams(LPDIRECT3DDEVICE9 device);
 
     D3DXVECTOR2 vec2(const float* a) {
         return D3DXVECTOR2(a[0], a[1]);
@@ -43,6 +54,7 @@ private:
 
     enum {
         ZOOM_DIVISION = 1000,
+        MAX_PRIMITIVE_COUNT = 65535,
     };
 
 private:
@@ -50,6 +62,14 @@ private:
     D3DXVECTOR2    tmp_offset_;
     int      zoom_;
 
+    // draw_primitiveš
+    std::vector<vertex_type>   lines_;
+    std::vector<vertex_type>   triangles_;
+    bool                       cached_;
+    const std::vector<Primitive>*  cached_primitives_;
+    unsigned int               cached_version_;
+    int                        cached_step_;
+
 };
 
 #endif // PATHVIEW_RENDERER_HPP_
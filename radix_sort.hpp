@@ -0,0 +1,50 @@
+// 2026/10/19
+
+/*!
+	@file	  radix_sort.hpp
+	@brief	  <Tv>
+
+	64bitL[LSD\[g()
+	T̓o`key`(boost::uint64_t)
+*/
+
+#ifndef RADIX_SORT_HPP_
+#define RADIX_SORT_HPP_
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+// keỷkey_bitsrbgĕׂ
+// tmp͍Ɨ̈(vƓ傫ɂ)
+template <class T>
+void radix_sort(std::vector<T>& v, std::vector<T>& tmp, int key_bits = 64) {
+    const int RADIX_BITS = 8;
+    const size_t RADIX = size_t(1) << RADIX_BITS;
+
+    tmp.resize(v.size());
+    for (int shift = 0 ; shift < key_bits ; shift += RADIX_BITS) {
+        size_t count[RADIX] = { 0 };
+        for (const T& x: v) {
+            count[(x.key >> shift) & (RADIX - 1)]++;
+        }
+
+        // SȂבւsv
+        if (count[(v.empty() ? 0 : (v[0].key >> shift) & (RADIX - 1))] ==
+            v.size()) {
+            continue;
+        }
+
+        size_t offset = 0;
+        for (size_t i = 0 ; i < RADIX ; i++) {
+            size_t c = count[i];
+            count[i] = offset;
+            offset += c;
+        }
+        for (const T& x: v) {
+            tmp[count[(x.key >> shift) & (RADIX - 1)]++] = x;
+        }
+        v.swap(tmp);
+    }
+}
+
+#endif // RADIX_SORT_HPP_
@@ -10,35 +10,60 @@
 #ifndef SPH_HPP_
 #define SPH_HPP_
 
+#include <cassert>
+#include "neighbor_search.hpp"
+#include "cloud.hpp"
+
 // 長さ mm
 // 質量 g
 // 時間 s
 
 namespace sph {
 
-namespace detail {
+// 粒子の1メンバを並べて見る読み取り専用ビュー(コピーしない)
+// 要素の間隔はsizeof(T)ではなくstride()バイト
+template <class T>
+class StridedView {
+public:
+    typedef T   value_type;
 
-template <bool>
-struct If  {
-    template <class T, class U>
-    struct Inner {
-        typedef T type;
-    };
-};
+    class iterator {
+    public:
+        iterator(const char* p, size_t stride) : p_(p), stride_(stride) {}
+
+        const T& operator*() const { return *reinterpret_cast<const T*>(p_); }
+        const T* operator->() const { return &**this; }
+        iterator& operator++() { p_ += stride_; return *this; }
+        bool operator==(const iterator& x) const { return p_ == x.p_; }
+        bool operator!=(const iterator& x) const { return p_ != x.p_; }
 
-template <>
-struct If<false> {
-    template <class T, class U>
-    struct Inner {
-        typedef U type;
+    private:
+        const char* p_;
+        size_t      stride_;
     };
-};
+    typedef iterator const_iterator;
 
-} // namespace detail
+public:
+    StridedView() : base_(nullptr), stride_(0), size_(0) {}
+    StridedView(const T* base, size_t stride, size_t size)
+        : base_(reinterpret_cast<const char*>(base)),
+          stride_(stride), size_(size) {}
+
+    const T& operator[](size_t i) const {
+        return *reinterpret_cast<const T*>(base_ + stride_ * i);
+    }
+
+    iterator begin() const { return iterator(base_, stride_); }
+    iterator end() const { return iterator(base_ + stride_ * size_, stride_); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t stride() const { return stride_; }
+
+private:
+    const char* base_;
+    size_t      stride_;
+    size_t      size_;
 
-template <bool B, class T, class U>
-struct If  {
-    typedef typename detail::If <B>::template Inner<T, U>::type type;
 };
 
 template < class Traits >
@@ -49,7 +74,6 @@ private:
     typedef typename Traits::load_type		load_type;
 
     struct Particle {
-        Particle*	next;
         int		id;
 		
         vector_type	new_position;
@@ -68,7 +92,20 @@ private:
         real_type	density_repulsive_denominator;
         real_type	density_repulsive_corrected;
         real_type	boundariness;	// boundary if < 1.0f
-        vector_type	move;
+        vector_type	move;		// 前に進めたときに圧力で押された分
+
+        // multi-rate用
+        // 2^level回のupdateに1回だけ進める(静止粒子は常にactive)
+        short		level;
+        bool		active;		// 今回のupdateで進めた
+        real_type	pending_dt;	// 前に進めてから溜まったdt
+        real_type	prev_dt;	// 前に進めたときのdt(0なら未だ)
+
+        // hybrid用
+        bool		cloud;		// 今回のupdateはcloudの押し出しだけで動かす
+        short		combat;		// 違うgroupに触れてからの残りupdate数
+
+        int		group;		// Traits::group(load)
         load_type	load;
     };
 
@@ -76,38 +113,40 @@ private:
         Particle*	car;
         Particle*	cdr;
         vector_type	diff;
-        real_type	length_sq;
         real_type	length;
-    };
-
-    class HashTable {
-    public:
-        template < class V >
-        HashTable( V& v )
-        {
-            memset( table_, 0, sizeof( table_ ) );
 
-            for( typename V::iterator i = v.begin() ; i != v.end() ; ++i ) {
-                Particle& pi = *i;
+        // update_pairsで1回だけ求めておくカーネル値
+        real_type	k_plain;	// kernelc() * kernel3(length_sq)
+        real_type	k2;		// kernel2(length)
+        real_type	k3;		// kernel3(length)
+    };
 
-                int coord[Traits::DIMENSION];
-                Traits::make_coords( coord, pi.new_position );
-                size_t h = Traits::hash( coord, TABLE_SIZE );
-                pi.next = table_[h];
-                table_[h] = &pi;
-            }	
-        }
-        ~HashTable() { }
+    // hybridでどちらもcloudの粒子の組(カーネル値も密度も求めない)
+    struct CloudPair {
+        Particle*	car;
+        Particle*	cdr;
+        vector_type	diff;
+        real_type	length_sq;
+    };
 
-        Particle* find(const int a[]) {
-            return table_[Traits::hash(a, TABLE_SIZE)];
-        }
+    // 静止粒子どうしの組(粒子は番号で持つ)
+    // 動かないのでrelaxには入れず、密度の寄与は粒子ごとに覚えておく
+    // boundarinessと補正密度は相手の今の密度で割るのでカーネル値を覚えておく
+    struct StaticPair {
+        int         car;
+        int         cdr;
+        real_type   length;
+        real_type   k_plain;
+        real_type   k2;
+        real_type   k3;
+    };
 
-    private:
-        enum { TABLE_SIZE = 4997 };
-        Particle*	table_[TABLE_SIZE];
+    struct StaticDensity {
+        real_type   plain;
+        real_type   balance;
+        real_type   repulsive;
     };
-	
+
     static real_type kernelc() {
         return
             real_type(315.0)/
@@ -125,7 +164,44 @@ private:
     }
 
 public:
-    sph() {}
+    // updateが求める値
+    // 圧力の計算に要るものはマスクに関わらず求める
+    enum Output {
+        OUTPUT_DENSITY_PLAIN                = 1 << 0,
+        OUTPUT_BOUNDARINESS                 = 1 << 1,
+        OUTPUT_DENSITY_BALANCE_CORRECTED    = 1 << 2,
+        OUTPUT_DENSITY_REPULSIVE_CORRECTED  = 1 << 3,
+        OUTPUT_ALL                          = 15,
+    };
+
+    // 圧力の解き方
+    enum Solver {
+        // double density relaxation(既定)
+        // 押し出し量がdt^2に比例するので大きいdtでは暴れる
+        SOLVER_DOUBLE_DENSITY,
+
+        // position based fluids
+        // 密度がrest densityを超えたところだけ位置の拘束として解く
+        // 押し出し量がdtに依らないので大きいdtでも安定
+        SOLVER_PBF,
+    };
+
+    // Traitsで0にした項はコンパイル時に消える
+    // (そのときinitializeの係数は使わない)
+    enum {
+        USE_GRAVITY             = Traits::USE_GRAVITY,
+        USE_BALANCE_PRESSURE    = Traits::USE_BALANCE_PRESSURE,
+    };
+
+public:
+    sph()
+        : static_count_(0), static_dirty_(false), next_id_(0),
+          C_(0), prev_dt_(0),
+          max_speed_(0), tick_(0), max_time_level_(0),
+          time_level_displacement_(0), solver_(SOLVER_DOUBLE_DENSITY),
+          pbf_rest_density_(1), pbf_iterations_(2), pbf_relaxation_(1),
+          hybrid_(false), cloud_repulsion_(0), cloud_cooldown_(0),
+          outputs_(OUTPUT_ALL), computed_(0) {}
     ~sph() {}
 
     void initialize(
@@ -136,7 +212,13 @@ public:
         real_type ideal_density,
         real_type pressure_balance_coefficient,
         real_type pressure_repulsive_coefficient) {
+        // Traitsで外した項の係数が0でなければ黙って無視されてしまう
+        assert(USE_GRAVITY || Traits::length_sq(gravity) == 0);
+        assert(USE_BALANCE_PRESSURE || pressure_balance_coefficient == 0);
+
         C_ = 0;
+        prev_dt_ = 0;
+        max_speed_ = 0;
 
         // radiusが1.0になるようにパラメータを正規化
         //(9乘しているところとかあるので)
@@ -151,6 +233,7 @@ public:
 
     void add_particle(const vector_type& v, real_type mass, load_type load) {
         Particle p;
+        p.id = next_id_++;
         p.new_position = v / src_search_radius_;
         p.old_position = p.new_position;
         p.mass = mass;
@@ -159,21 +242,39 @@ public:
         p.density_repulsive = ideal_density_;
         p.move = Traits::zero_vector();
         p.load = load;
+        p.level = 0;
+        p.active = true;
+        p.group = Traits::group(load);
+        p.pending_dt = 0;
+        p.prev_dt = 0;
+        p.cloud = false;
+        p.combat = 0;
         particles_.push_back(p);
     }
 
-    int pick(const vector_type& p, real_type range) {
-        real_type maxlen = (std::numeric_limits<real_type>::max)();  
+    // 動かない粒子
+    // 積分・constraintからは外れるが、密度と圧力には固定境界として効く
+    // (静止粒子は先頭にまとめておく)
+    void add_static_particle(
+        const vector_type& v, real_type mass, load_type load) {
+        add_particle(v, mass, load);
+        std::swap(particles_[static_count_], particles_.back());
+        static_count_++;
+        static_dirty_ = true;
+    }
 
-        int id = -1;
-        for (size_t i = 0 ; i <particles_.size(); i++) {
-            vector_type pos = particles_[i].new_position;
+    size_t static_particle_count() const { return static_count_; }
+
+    int pick(const vector_type& pos, real_type range) {
+        real_type maxlen = (std::numeric_limits<real_type>::max)();
 
-            vector_type diff = pos - p;
-            real_type len = Traits::length_square(diff);
-            if (len <maxlen) {
+        int id = -1;
+        for (const Particle& p: particles_) {
+            real_type len = Traits::length_sq(
+                p.new_position * src_search_radius_ - pos);
+            if (len < maxlen) {
                 maxlen = len;
-                id = int(i);
+                id = p.id;
             }
         }
 
@@ -197,12 +298,67 @@ public:
                 p.load);
         }
     }
+
+    size_t particle_count() const { return particles_.size(); }
+
+    // 粒子の中身を直接見るビュー
+    // add_particle/discardで無効になる
+    // 位置は正規化されているのでposition_scale()を掛けて使う
+    real_type position_scale() const { return src_search_radius_; }
+    StridedView<vector_type> positions() const {
+        return view(&Particle::new_position);
+    }
+    StridedView<load_type> loads() const { return view(&Particle::load); }
+    StridedView<real_type> masses() const { return view(&Particle::mass); }
+    StridedView<real_type> densities_plain() const {
+        return view(&Particle::density_plain);
+    }
+    StridedView<real_type> densities_balance_corrected() const {
+        return view(&Particle::density_balance_corrected);
+    }
+    StridedView<real_type> densities_repulsive_corrected() const {
+        return view(&Particle::density_repulsive_corrected);
+    }
+    StridedView<real_type> boundarinesses() const {
+        return view(&Particle::boundariness);
+    }
+    // multi-rateのlevel(get_max_time_levelと同じなら一番静か)
+    StridedView<short> time_levels() const { return view(&Particle::level); }
+
+    // foreachやビューで読む値をOutputの組み合わせで指定する
+    // 指定しなかった値は圧力に要らなければ求めない(中身は不定)
+    void set_outputs(unsigned int mask) { outputs_ = mask; }
+    unsigned int get_outputs() { return outputs_; }
+
+    // 直近のupdateで求めなかった値を後から求める(デバッグ表示用)
+    // 次のupdateまではupdateで求めた場合と同じ値になる
+    // USE_BALANCE_PRESSUREが0のときbalanceの補正密度は求められない
+    void compute_outputs(unsigned int mask) {
+        if (!USE_BALANCE_PRESSURE) {
+            mask &= ~OUTPUT_DENSITY_BALANCE_CORRECTED;
+        }
+        mask &= ~computed_;
+        if (mask & (OUTPUT_DENSITY_BALANCE_CORRECTED |
+                    OUTPUT_DENSITY_REPULSIVE_CORRECTED)) {
+            mask |= OUTPUT_BOUNDARINESS & ~computed_;
+        }
+
+        // density_plainはupdate_pairsで求めてある
+        if (mask & OUTPUT_BOUNDARINESS) { designate_boundary(); }
+        if (mask & (OUTPUT_DENSITY_BALANCE_CORRECTED |
+                    OUTPUT_DENSITY_REPULSIVE_CORRECTED)) {
+            normalize_density(mask);
+        }
+        computed_ |= mask;
+    }
 	
     template <class F>
     void constraint(F f) {
         real_type i_src_search_radius = real_type(1)/ src_search_radius_;
 
-        for (Particle& p: particles_) {
+        for (size_t i = static_count_ ; i < particles_.size() ; i++) {
+            Particle& p = particles_[i];
+            if (!p.active) { continue; }
             p.new_position =
                 f(p.new_position * src_search_radius_)
                 * i_src_search_radius;
@@ -211,12 +367,23 @@ public:
 
     template <class F>
     void discard(F f) {
+        // remove_ifは順序を保つので静止粒子は先頭のまま
+        // (述語は元の位置の要素に1回ずつ呼ばれる)
+        size_t removed_static = 0;
         particles_.erase(
             std::remove_if(
                 particles_.begin(),
                 particles_.end(),
-                [&](const Particle& p){ return f(p.load); }),
+                [&](const Particle& p){
+                    if (!f(p.load)) { return false; }
+                    if (is_static(p)) { removed_static++; }
+                    return true;
+                }),
             particles_.end());
+        if (0 < removed_static) {
+            static_count_ -= removed_static;
+            static_dirty_ = true;
+        }
     }
 
     template <class F>
@@ -224,258 +391,718 @@ public:
         for (Pair& p: pairs_) {
             f(p.car->load, p.cdr->load, p.length);
         }
+        for (const StaticPair& p: static_pairs_) {
+            f(particles_[p.car].load, particles_[p.cdr].load, p.length);
+        }
+        for (CloudPair& p: cloud_pairs_) {
+            f(p.car->load, p.cdr->load, sqrt(p.length_sq));
+        }
     }
 	
+    // dtはステップごとに変えてもよい
+    // (速度は前のステップのdtで割って求める)
     void update(real_type dt) {
         C_ = 0;
+        max_speed_ = 0;
+
+        // multi-rateを使わないときは粒子ごとの判定を外す
+        if (0 < max_time_level_) {
+            integrate<true>(dt);
+        } else {
+            integrate<false>(dt);
+        }
+        tick_++;
+
+        // 近傍を探しながらdensity_plainと密度も足しておく
+        if (0 < max_time_level_) {
+            update_pairs<true>();
+        } else {
+            update_pairs<false>();
+        }
+
+        computed_ = OUTPUT_DENSITY_PLAIN;
+        if (solver_ == SOLVER_PBF) {
+            // 補正密度は使わない
+            compute_outputs(outputs_);
+            if (0 < max_time_level_) {
+                project_density<true>();
+            } else {
+                project_density<false>();
+            }
+        } else {
+            // 係数が0の圧力の補正密度は要らない
+            unsigned int mask = outputs_;
+            if (USE_BALANCE_PRESSURE && pressure_balance_coefficient_ != 0) {
+                mask |= OUTPUT_DENSITY_BALANCE_CORRECTED;
+            }
+            if (pressure_repulsive_coefficient_ != 0) {
+                mask |= OUTPUT_DENSITY_REPULSIVE_CORRECTED;
+            }
+            compute_outputs(mask);
+
+            if (0 < max_time_level_) {
+                double_density_relaxation<true>();
+            } else {
+                double_density_relaxation<false>();
+            }
+        }
+
+        if (0 < max_time_level_) {
+            relax_cloud<true>();
+        } else {
+            relax_cloud<false>();
+        }
+    }
+
+    void set_viscosity( real_type v ) { viscosity_ = v; }
+    real_type get_viscosity() { return viscosity_; }
+    void set_dumping( real_type d ) { dumping_ = d; }
+    real_type get_dumping() { return dumping_; }
+
+    void set_ideal_density(float x) {
+        ideal_density_ = x;
+        for (int i = 0 ; i <int(particles_.size()); i++) {
+            Particle& pi = particles_[i];
+            pi.density0 = x;
+        }
+    }
+
+    float get_ideal_density() {
+        return ideal_density_;
+    }
+
+    // 直近のupdateで見た1ステップあたりの最大移動量と最大速度
+    // (どちらも探索半径を1とした単位、速度は/s)
+    // multi-rateでまとめて進めた粒子は毎回進めた場合の1回分に直して見る
+    // dtを決めるときのCFL条件に使う
+    real_type get_max_displacement() const { return C_; }
+    real_type get_max_speed() const { return max_speed_; }
+
+    // SOLVER_PBFのパラメータ
+    // rest_density: density_repulsive(自分を1とした(1-r)^3の和)の上限
+    // iterations: 1回のupdateで拘束を解く回数
+    // relaxation: λの分母に足す値(大きいほど柔らかい)
+    void set_solver(Solver s) { solver_ = s; }
+    Solver get_solver() const { return solver_; }
+    void set_pbf_parameters(
+        real_type rest_density, int iterations, real_type relaxation) {
+        pbf_rest_density_ = rest_density;
+        pbf_iterations_ = iterations;
+        pbf_relaxation_ = relaxation;
+    }
+
+    // multi-rate
+    // 2^level回のupdate分の移動量がdisplacement(探索半径単位)に
+    // 収まる粒子は2^levelのupdateに1回(最大2^max_level)だけ進める
+    // 止めている粒子どうしの組は作らない
+    // 止めている粒子は前に進めたときの速度で外挿した位置で隣と組になる
+    // その密度と圧力は前に進めたときのまま(隣とlevelが1までしか違わず、
+    // 周りも遅いので、止めている間の密度の変化は小さい)
+    // 隣の粒子とはlevelが1までしか違わないようにし、
+    // 違うgroupの粒子と組になったらlevel 0に戻す
+    // (groupはTraits::group、負ならどのgroupとも同じ扱い)
+    // max_levelが0(既定)なら全粒子を毎回進める
+    void set_time_levels(int max_level, real_type displacement) {
+        max_time_level_ = max_level;
+        time_level_displacement_ = displacement;
+        if (max_level <= 0) {
+            for (Particle& p: particles_) {
+                p.level = 0;
+                p.active = true;
+                p.pending_dt = 0;
+            }
+        }
+    }
+    int get_max_time_level() const { return max_time_level_; }
+
+    // hybrid
+    // 違うgroupの粒子にcooldown回のupdateのあいだ触れていない
+    // 粒子はcloud::cloudの押し出し(係数repulsion、dtの2乗を掛ける)だけで動かす
+    // cloudの粒子どうしの組は密度にも圧力にも入らない
+    // (cloudの粒子の密度とboundarinessはほかの組の分だけになる)
+    void set_hybrid(bool enable, real_type repulsion, int cooldown) {
+        hybrid_ = enable;
+        cloud_repulsion_ = repulsion;
+        cloud_cooldown_ = cooldown;
+        if (!enable) {
+            for (Particle& p: particles_) { p.cloud = false; }
+        }
+    }
+    bool get_hybrid() const { return hybrid_; }
+
+    // 直近のupdateでcloudで動かした粒子の数
+    size_t cloud_particle_count() const {
+        size_t n = 0;
+        for (const Particle& p: particles_) {
+            if (p.cloud) { n++; }
+        }
+        return n;
+    }
+
+    // 直近のupdateで進めた静止していない粒子の数
+    size_t active_particle_count() const {
+        size_t n = 0;
+        for (size_t i = static_count_ ; i < particles_.size() ; i++) {
+            if (particles_[i].active) { n++; }
+        }
+        return n;
+    }
+						   
+private:
+    bool is_static(const Particle& p) const {
+        return &p < &particles_[0] + static_count_;
+    }
 
-        real_type idt = real_type(1.0) / dt;
+    // 組を作るときの位置
+    template <bool MULTI_RATE>
+    const vector_type& pair_position(const Particle& p) const {
+        if (MULTI_RATE && !p.active) {
+            return pair_positions_[&p - &particles_[0]];
+        }
+        return p.new_position;
+    }
+
+    // verlet integration
+    template <bool MULTI_RATE>
+    void integrate(real_type dt) {
         real_type i_src_search_radius = real_type(1.0) / src_search_radius_;
+        real_type common_idt =
+            real_type(1.0) / (0 < prev_dt_ ? prev_dt_ : dt);
+        prev_dt_ = dt;
 
-        // verlet integration
-        for (size_t i = 0 ; i <particles_.size(); i++) {
+        for (size_t i = static_count_ ; i <particles_.size(); i++) {
             Particle& p = particles_[i];
 
+            real_type pdt = dt;
+            real_type idt = common_idt;
+            if (MULTI_RATE) {
+                // levelの周期に当たらない粒子は止めておいてdtだけ溜める
+                p.active = (tick_ & ((1u << p.level) - 1)) == 0;
+                if (!p.active) {
+                    p.pending_dt += dt;
+                    continue;
+                }
+                pdt = p.pending_dt + dt;
+                idt = real_type(1.0) / (0 < p.prev_dt ? p.prev_dt : pdt);
+                p.pending_dt = 0;
+            }
+            p.prev_dt = pdt;
+
             // use previous position to compute next velocity
             vector_type vdt = p.new_position - p.old_position;
             vector_type v = vdt * idt;
 
             p.new_position += 
                 Traits::move(p.load, p.new_position * src_search_radius_) * 
-                i_src_search_radius * dt;
+                i_src_search_radius * pdt;
 
             // save previous position
             p.old_position = p.new_position;
 
             // compute velocity
-            vector_type fgrav = gravity_ * p.mass;
-            vector_type a = fgrav / p.density_balance * dt;
-            v += a;
+            if (USE_GRAVITY) {
+                vector_type fgrav = gravity_ * p.mass;
+                vector_type a = fgrav / p.density_balance * pdt;
+                v += a;
+            }
             real_type speed = Traits::length(vdt);
-            C_ =(std::max)(speed, C_);
+            if (MULTI_RATE) {
+                // 何回分かまとめて進めた粒子の移動量を1回分に直す
+                // (速度の分はdtに、圧力で押された分はdtの2乗に比例する)
+                real_type r = idt / common_idt;
+                C_ = (std::max)(
+                    Traits::length((vdt - p.move) * r + p.move * (r * r)),
+                    C_);
+
+                // 上げるのは1段ずつ(圧力で押される分は後から速度に出るので)
+                p.level = short(
+                    (std::min)(time_level(speed * idt * dt), p.level + 1));
+            } else {
+                C_ = (std::max)(speed, C_);
+            }
 
             v = Traits::constraint_velocity(
                 p.load, 
                 v * src_search_radius_) * i_src_search_radius;
 
             // advance to predicted position
-            p.new_position += v * dt * dumping_;
+            p.new_position += v * pdt * dumping_;
         }
-
-        update_pairs();
-        compute_plain_density();
-        designate_boundary();
-        compute_density();
-        normalize_density();
-        double_density_relaxation(dt);
+        max_speed_ = C_ * common_idt;
     }
 
-    void set_viscosity( real_type v ) { viscosity_ = v; }
-    real_type get_viscosity() { return viscosity_; }
-    void set_dumping( real_type d ) { dumping_ = d; }
-    real_type get_dumping() { return dumping_; }
-
-    void set_ideal_density(float x) {
-        ideal_density_ = x;
-        for (int i = 0 ; i <int(particles_.size()); i++) {
-            Particle& pi = particles_[i];
-            pi.density0 = x;
+    int time_level(real_type displacement) const {
+        int level = 0;
+        while (level < max_time_level_ &&
+               displacement * real_type(2 << level) <=
+               time_level_displacement_) {
+            level++;
         }
+        return level;
     }
 
-    float get_ideal_density() {
-        return ideal_density_;
+    void settle_time_levels(Particle& pi, Particle& pj, bool same_group) {
+        if (!same_group) {
+            pi.level = 0;
+            pj.level = 0;
+        } else if (is_static(pi) || is_static(pj)) {
+            // 静止粒子のlevelは使わない
+        } else if (pj.level + 1 < pi.level) {
+            pi.level = short(pj.level + 1);
+        } else if (pi.level + 1 < pj.level) {
+            pj.level = short(pi.level + 1);
+        }
     }
-						   
-private:
-    struct update_pairs_0 {
-        static void exec(
-            Particle& pi,
-            HashTable& ht,
-            const int coords[2][Traits::DIMENSION],
-            int c[Traits::DIMENSION],
-            std::vector<Pair>& pairs) {
-            for (Particle* p = ht.find(c) ; p ; p = p->next) {
-                Particle& pj = *p;
-                if (&pj <= &pi) { continue; }
-
-                vector_type v = pj.new_position - pi.new_position;
-                real_type length_sq = Traits::length_sq(v);
-                if (real_type(1.0) <= length_sq) { continue; }
-
-                Pair pair;
+
+    template <bool MULTI_RATE>
+    void add_pair(Particle& pi, Particle& pj) {
+        // 止めている粒子どうしは調べない
+        if (MULTI_RATE && !pi.active && !pj.active) { return; }
+
+        // 静止粒子どうしは静止粒子が変わったときだけ調べる
+        bool both_static = is_static(pi) && is_static(pj);
+        if (both_static && !static_dirty_) { return; }
+
+        vector_type v =
+            pair_position<MULTI_RATE>(pj) - pair_position<MULTI_RATE>(pi);
+        real_type length_sq = Traits::length_sq(v);
+        if (real_type(1.0) <= length_sq) { return; }
+
+        bool same_group =
+            pi.group == pj.group || pi.group < 0 || pj.group < 0;
+        if (hybrid_) {
+            if (!same_group) {
+                pi.combat = short(cloud_cooldown_);
+                pj.combat = short(cloud_cooldown_);
+            }
+            if (pi.cloud && pj.cloud) {
+                CloudPair pair;
                 pair.car = &pi;
                 pair.cdr = &pj;
                 pair.diff = v;
                 pair.length_sq = length_sq;
-                pair.length = sqrt(length_sq);
-                pairs.push_back(pair);
+                cloud_pairs_.push_back(pair);
+                if (MULTI_RATE) { settle_time_levels(pi, pj, same_group); }
+                return;
             }
         }
-    };
 
-    template <int M, int N>
-    struct update_pairs_n {
-        static void exec(
-            Particle& pi,
-            HashTable& ht,
-            const int coords[2][Traits::DIMENSION],
-            int c[Traits::DIMENSION],
-            std::vector<Pair>& pairs) {
-            for (int i = coords[0][N] ; i <= coords[1][N] ; i++) {
-                c[N] = i;
-                typename If <
-                    M == N + 1,
-                    update_pairs_0,
-                    update_pairs_n<M, N+1>>::type::exec(
-                        pi, ht, coords, c, pairs);
+        Pair pair;
+        pair.car = &pi;
+        pair.cdr = &pj;
+        pair.diff = v;
+        pair.length = sqrt(length_sq);
+        pair.k_plain = kernelc()* kernel3(length_sq);
+        pair.k2 = kernel2(pair.length);
+        pair.k3 = kernel3(pair.length);
+
+        // compute plain density / density
+        if (both_static) {
+            StaticPair sp;
+            sp.car = int(&pi - &particles_[0]);
+            sp.cdr = int(&pj - &particles_[0]);
+            sp.length = pair.length;
+            sp.k_plain = pair.k_plain;
+            sp.k2 = pair.k2;
+            sp.k3 = pair.k3;
+            static_pairs_.push_back(sp);
+            accumulate_density(
+                static_densities_[sp.car], static_densities_[sp.cdr],
+                pi, pj, pair);
+        } else {
+            pairs_.push_back(pair);
+
+            // 止めている側の密度は前のまま
+            if (!MULTI_RATE || (pi.active && pj.active)) {
+                accumulate_density(pi, pj, pi, pj, pair);
+            } else {
+                StaticDensity sink = { 0, 0, 0 };
+                if (pi.active) {
+                    accumulate_density(pi, sink, pi, pj, pair);
+                } else {
+                    accumulate_density(sink, pj, pi, pj, pair);
+                }
             }
+            if (MULTI_RATE) { settle_time_levels(pi, pj, same_group); }
         }
-    };
+    }
 
+    template <class DI, class DJ>
+    void accumulate_density(
+        DI& di, DJ& dj, const Particle& pi, const Particle& pj,
+        const Pair& pair) {
+        density_plain(di) += pair.k_plain;
+        density_plain(dj) += pair.k_plain;
+        if (USE_GRAVITY || USE_BALANCE_PRESSURE) {
+            density_balance(di) += pj.mass * pair.k2;
+            density_balance(dj) += pi.mass * pair.k2;
+        }
+        density_repulsive(di) += pj.mass * pair.k3;
+        density_repulsive(dj) += pi.mass * pair.k3;
+    }
+
+    static real_type& density_plain(Particle& p) { return p.density_plain; }
+    static real_type& density_balance(Particle& p) {
+        return p.density_balance;
+    }
+    static real_type& density_repulsive(Particle& p) {
+        return p.density_repulsive;
+    }
+    static real_type& density_plain(StaticDensity& d) { return d.plain; }
+    static real_type& density_balance(StaticDensity& d) { return d.balance; }
+    static real_type& density_repulsive(StaticDensity& d) {
+        return d.repulsive;
+    }
+
+    template <bool MULTI_RATE>
     void update_pairs() {
-        const real_type  r1 = real_type(1.0);
-        const vector_type unit = Traits::unit_vector();
+        int n = int(particles_.size());
 
-        HashTable ht(particles_);
         pairs_.clear();
+        cloud_pairs_.clear();
+        if (static_dirty_) {
+            static_pairs_.clear();
+            StaticDensity zero = { 0, 0, 0 };
+            static_densities_.assign(static_count_, zero);
+        }
 
-        for (int i = 0 ; i <int(particles_.size()); i++) {
+        // 相手側にも足すので先に全部初期化する
+        for (int i = 0 ; i < n ; i++) {
             Particle& pi = particles_[i];
+            if (MULTI_RATE && !pi.active) { continue; }
+            pi.density_plain = kernelc();
+            pi.density_balance =
+                (USE_GRAVITY || USE_BALANCE_PRESSURE) ? pi.mass : 0;
+            pi.density_repulsive = pi.mass;
 
-            int coords[2][Traits::DIMENSION];
-            Traits::make_coords(coords[0], pi.new_position - unit);
-            Traits::make_coords(coords[1], pi.new_position + unit);
-
-            // traverse 
-            pi.density_plain  = 0;
-            pi.density_balance  = 0;
-            pi.density_repulsive = 0;
-
-            int c[Traits::DIMENSION];
-            typename update_pairs_n<Traits::DIMENSION, 0>::exec(
-                pi, ht, coords, c, pairs_);
+            // 前のupdateまでに違うgroupに触れていなければcloud
+            pi.cloud = hybrid_ && pi.combat == 0 && !is_static(pi);
+            if (0 < pi.combat) { pi.combat--; }
         }
-    }
-	
-    void compute_plain_density() {
-        for (int i = 0 ; i <int(particles_.size()); i++) {
-            Particle& pi = particles_[i];
-            pi.density_plain = kernelc();
+        if (n == 0) { return; }
+
+        // 止めている粒子は前に進めたときの速度で今の時刻まで外挿する
+        if (MULTI_RATE) {
+            pair_positions_.resize(n);
+            for (int i = 0 ; i < n ; i++) {
+                const Particle& pi = particles_[i];
+                if (pi.active) { continue; }
+                pair_positions_[i] = pi.new_position;
+                if (0 < pi.prev_dt) {
+                    pair_positions_[i] +=
+                        (pi.new_position - pi.old_position) *
+                        (pi.pending_dt / pi.prev_dt * dumping_);
+                }
+            }
         }
 
-        for (int i = 0 ; i <int(pairs_.size()); i++) {
-            Pair& pair = pairs_[i];
-            Particle& pi = *pair.car;
-            Particle& pj = *pair.cdr;
-
-            real_type kernel = kernelc()* kernel3(pair.length_sq);
-            pi.density_plain += kernel;
-            pj.density_plain += kernel;
+        neighbor_search_.foreach_candidate(
+            n,
+            [this](int i) -> const vector_type& {
+                return pair_position<MULTI_RATE>(particles_[i]);
+            },
+            [this](int i, int j) {
+                add_pair<MULTI_RATE>(particles_[i], particles_[j]);
+            });
+
+        // 静止粒子どうしの寄与は覚えておいたものを足す
+        static_dirty_ = false;
+        for (size_t i = 0 ; i < static_count_ ; i++) {
+            Particle& pi = particles_[i];
+            const StaticDensity& d = static_densities_[i];
+            pi.density_plain += d.plain;
+            pi.density_balance += d.balance;
+            pi.density_repulsive += d.repulsive;
         }
     }
-	
+
     void designate_boundary() {
         for (int i = 0 ; i <int(particles_.size()); i++) {
             Particle& pi = particles_[i];
+            if (!pi.active) { continue; }
             pi.boundariness = kernelc()/ pi.density_plain;
         }
 
-        for (int i = 0 ; i <int(pairs_.size()); i++) {
-            Pair& pair = pairs_[i];
-            Particle& pi = *pair.car;
-            Particle& pj = *pair.cdr;
-
-            float kernel = kernelc()* kernel3(pair.length_sq);
-            pi.boundariness += pj.mass * kernel / pj.density_plain;
-            pj.boundariness += pi.mass * kernel / pi.density_plain;
+        for (const Pair& pair: pairs_) {
+            add_boundariness(*pair.car, *pair.cdr, pair.k_plain);
+        }
+        for (const StaticPair& sp: static_pairs_) {
+            add_boundariness(
+                particles_[sp.car], particles_[sp.cdr], sp.k_plain);
         }
     }
 
-    void compute_density() {
-        for (int i = 0 ; i <int(particles_.size()); i++) {
-            Particle& pi = particles_[i];
-            pi.density_balance    = pi.mass;
-            pi.density_repulsive  = pi.mass;
+    void add_boundariness(Particle& pi, Particle& pj, real_type k_plain) {
+        if (pi.active) {
+            pi.boundariness += pj.mass * k_plain / pj.density_plain;
         }
+        if (pj.active) {
+            pj.boundariness += pi.mass * k_plain / pi.density_plain;
+        }
+    }
 
-        for (int i = 0 ; i <int(pairs_.size()); i++) {
-            Pair& pair = pairs_[i];
-            Particle& pi = *pair.car;
-            Particle& pj = *pair.cdr;
-
-            pi.density_balance += pj.mass * kernel2(pair.length);
-            pi.density_repulsive += pj.mass * kernel3(pair.length);
-
-            pj.density_balance += pi.mass * kernel2(pair.length);
-            pj.density_repulsive += pi.mass * kernel3(pair.length);
+    void normalize_density(unsigned int mask) {
+        if (!(mask & OUTPUT_DENSITY_BALANCE_CORRECTED)) {
+            normalize_density<false, true>();
+        } else if (!(mask & OUTPUT_DENSITY_REPULSIVE_CORRECTED)) {
+            normalize_density<true, false>();
+        } else {
+            normalize_density<true, true>();
         }
     }
-	
+
+    template <bool BALANCE, bool REPULSIVE>
     void normalize_density() {
         for (int i = 0 ; i <int(particles_.size()); i++) {
             Particle& pi = particles_[i];
-            pi.density_balance_numerator = pi.mass;
-            pi.density_balance_denominator = pi.mass / pi.density_balance;
-            pi.density_repulsive_numerator = pi.mass;
-            pi.density_repulsive_denominator = pi.mass / pi.density_repulsive;
+            if (!pi.active) { continue; }
+            if (BALANCE) {
+                pi.density_balance_numerator = pi.mass;
+                pi.density_balance_denominator =
+                    pi.mass / pi.density_balance;
+            }
+            if (REPULSIVE) {
+                pi.density_repulsive_numerator = pi.mass;
+                pi.density_repulsive_denominator =
+                    pi.mass / pi.density_repulsive;
+            }
         }
 
-        for (int i = 0 ; i <int(pairs_.size()); i++) {
-            Pair& pair = pairs_[i];
-            Particle& pi = *pair.car;
-            Particle& pj = *pair.cdr;
+        for (const Pair& pair: pairs_) {
+            add_normalization<BALANCE, REPULSIVE>(
+                *pair.car, *pair.cdr, pair.k2, pair.k3);
+        }
+        for (const StaticPair& sp: static_pairs_) {
+            add_normalization<BALANCE, REPULSIVE>(
+                particles_[sp.car], particles_[sp.cdr], sp.k2, sp.k3);
+        }
 
-            real_type k2 = kernel2(pair.length);
-            real_type k3 = kernel3(pair.length);
+        for (int i = 0 ; i <int(particles_.size()); i++) {
+            Particle& pi = particles_[i];
+            if (!pi.active) { continue; }
+            if (BALANCE) {
+                if (Traits::epsilon() <= pi.density_balance_denominator) {
+                    pi.density_balance_corrected =
+                        pi.density_balance_numerator /
+                        pi.density_balance_denominator;
+                } else {
+                    pi.density_balance_corrected = pi.density_balance;
+                }
+            }
+            if (REPULSIVE) {
+                if (Traits::epsilon() <= pi.density_repulsive_denominator) {
+                    pi.density_repulsive_corrected =
+                        pi.density_repulsive_numerator /
+                        pi.density_repulsive_denominator;
+                } else {
+                    pi.density_repulsive_corrected = pi.density_repulsive;
+                }
+            }
+        }
+    }
 
-            if (real_type(1.0) <= pj.boundariness) {
+    template <bool BALANCE, bool REPULSIVE>
+    void add_normalization(
+        Particle& pi, Particle& pj, real_type k2, real_type k3) {
+        if (pi.active && real_type(1.0) <= pj.boundariness) {
+            if (BALANCE) {
                 real_type b = pj.mass * k2;
-                real_type r = pj.mass * k3;
                 pi.density_balance_numerator   += b;
                 pi.density_balance_denominator += b / pj.density_balance;
+            }
+            if (REPULSIVE) {
+                real_type r = pj.mass * k3;
                 pi.density_repulsive_numerator += r;
                 pi.density_repulsive_denominator += r / pj.density_repulsive;
             }
+        }
 
-            if (real_type(1.0) <= pi.boundariness) {
+        if (pj.active && real_type(1.0) <= pi.boundariness) {
+            if (BALANCE) {
                 real_type b = pi.mass * k2;
-                real_type r = pi.mass * k3;
                 pj.density_balance_numerator   += b;
                 pj.density_balance_denominator += b / pi.density_balance;
+            }
+            if (REPULSIVE) {
+                real_type r = pi.mass * k3;
                 pj.density_repulsive_numerator += r;
                 pj.density_repulsive_denominator += r / pi.density_repulsive;
             }
         }
     }
 	
-    void double_density_relaxation(float dt) {
-        for (int i = 0 ; i <int(particles_.size()); i++) {
-            Particle& pi = particles_[i];
-            pi.move = Traits::zero_vector();
+    // position based fluids
+    // C_i = max(ρ_i / ρ0 - 1, 0)をJacobi法で解く
+    // 質量の逆数で重みをつけ、静止粒子と止めている粒子は動かさない
+    // (止めている粒子の密度は揃っていないのでλは0とする)
+    template <bool MULTI_RATE>
+    void project_density() {
+        int n = int(particles_.size());
+        pbf_lambda_gradients_.resize(n);
+        pbf_denominators_.resize(n);
+        for (Particle& p: particles_) {
+            if (!MULTI_RATE || p.active) { p.move = Traits::zero_vector(); }
+        }
+        if (n == 0) { return; }
+
+        Particle* base = &particles_[0];
+        real_type irho0 = real_type(1.0) / pbf_rest_density_;
+
+        for (int iteration = 0 ; iteration < pbf_iterations_ ; iteration++) {
+            // 2回目からは動いた位置で密度を求め直す
+            // (1回目はupdate_pairsで求めてある)
+            if (0 < iteration) {
+                for (int i = 0 ; i < n ; i++) {
+                    Particle& pi = particles_[i];
+                    if (MULTI_RATE && !pi.active) { continue; }
+                    pi.density_repulsive = pi.mass;
+                    if (i < int(static_count_)) {
+                        pi.density_repulsive +=
+                            static_densities_[i].repulsive;
+                    }
+                }
+                for (Pair& pair: pairs_) {
+                    Particle& pi = *pair.car;
+                    Particle& pj = *pair.cdr;
+                    pair.diff = pair_position<MULTI_RATE>(pj) -
+                        pair_position<MULTI_RATE>(pi);
+                    real_type length_sq = Traits::length_sq(pair.diff);
+                    pair.length = sqrt(length_sq);
+                    pair.k2 = 0;
+                    pair.k3 = 0;
+                    if (length_sq < real_type(1.0)) {
+                        pair.k2 = kernel2(pair.length);
+                        pair.k3 = kernel3(pair.length);
+                    }
+                    if (!MULTI_RATE || pi.active) {
+                        pi.density_repulsive += pj.mass * pair.k3;
+                    }
+                    if (!MULTI_RATE || pj.active) {
+                        pj.density_repulsive += pi.mass * pair.k3;
+                    }
+                }
+            }
 
-            if (Traits::epsilon() <= pi.density_balance_denominator) {
-                pi.density_balance_corrected =
-                    pi.density_balance_numerator /
-                    pi.density_balance_denominator;
-            } else {
-                pi.density_balance_corrected = pi.density_balance;
+            // λ
+            // ∇W = 3(1-r)^2 n / ρ0 (nはiからjへ)
+            for (int i = 0 ; i < n ; i++) {
+                pbf_lambda_gradients_[i] = Traits::zero_vector();
+                pbf_denominators_[i] = 0;
+            }
+            for (const Pair& pair: pairs_) {
+                Particle& pi = *pair.car;
+                Particle& pj = *pair.cdr;
+                int i = int(&pi - base);
+                int j = int(&pj - base);
+                vector_type v_n = pair.diff;
+                if (Traits::epsilon() < pair.length) { v_n /= pair.length; }
+                real_type g = 3 * pair.k2 * irho0;
+
+                pbf_lambda_gradients_[i] += v_n * (g * pj.mass);
+                pbf_lambda_gradients_[j] -= v_n * (g * pi.mass);
+                if (is_movable<MULTI_RATE>(pj)) {
+                    pbf_denominators_[i] += pj.mass * square(g);
+                }
+                if (is_movable<MULTI_RATE>(pi)) {
+                    pbf_denominators_[j] += pi.mass * square(g);
+                }
+            }
+            for (int i = 0 ; i < n ; i++) {
+                Particle& pi = particles_[i];
+                real_type c = pi.density_repulsive * irho0 - 1;
+                real_type lambda = 0;
+                if ((!MULTI_RATE || pi.active) && 0 < c) {
+                    real_type d = pbf_denominators_[i] + pbf_relaxation_;
+                    if (is_movable<MULTI_RATE>(pi)) {
+                        d += Traits::length_sq(pbf_lambda_gradients_[i]) /
+                            pi.mass;
+                    }
+                    lambda = -c / d;
+                }
+                pi.pressure_repulsive = lambda;
             }
 
-            if (Traits::epsilon() <= pi.density_repulsive_denominator) {
-                pi.density_repulsive_corrected =
-                    pi.density_repulsive_numerator /
-                    pi.density_repulsive_denominator;
-            } else {
-                pi.density_repulsive_corrected = pi.density_repulsive;
+            // Δp (pbf_lambda_gradients_を使い回す)
+            for (int i = 0 ; i < n ; i++) {
+                pbf_lambda_gradients_[i] = Traits::zero_vector();
+            }
+            for (const Pair& pair: pairs_) {
+                Particle& pi = *pair.car;
+                Particle& pj = *pair.cdr;
+                real_type li = pi.pressure_repulsive;
+                real_type lj = pj.pressure_repulsive;
+                if (li == 0 && lj == 0) { continue; }
+
+                int i = int(&pi - base);
+                int j = int(&pj - base);
+                vector_type v_n = pair.diff;
+                if (Traits::epsilon() < pair.length) { v_n /= pair.length; }
+                real_type g = 3 * pair.k2 * irho0;
+
+                pbf_lambda_gradients_[i] +=
+                    v_n * ((li * pj.mass / pi.mass + lj) * g);
+                pbf_lambda_gradients_[j] -=
+                    v_n * ((lj * pi.mass / pj.mass + li) * g);
             }
+            for (int i = 0 ; i < n ; i++) {
+                Particle& pi = particles_[i];
+                if (!is_movable<MULTI_RATE>(pi)) { continue; }
+                pi.new_position += pbf_lambda_gradients_[i];
+                pi.move += pbf_lambda_gradients_[i];
+            }
+        }
+    }
+
+    // hybridのcloudの粒子どうしの組
+    // cloud::cloudと同じ押し出しだが、押した分は次のupdateで速度になるので
+    // double density relaxationと同じく押される側のdtの2乗に比例させる
+    template <bool MULTI_RATE>
+    void relax_cloud() {
+        for (const CloudPair& pair: cloud_pairs_) {
+            Particle& pi = *pair.car;
+            Particle& pj = *pair.cdr;
+            if (!MULTI_RATE || pi.active) {
+                vector_type v = cloud::cloud<Traits>::repulsion(
+                    pair.diff, pair.length_sq,
+                    cloud_repulsion_ * square(pi.prev_dt));
+                pi.new_position -= v;
+                pi.move -= v;
+            }
+            if (!MULTI_RATE || pj.active) {
+                vector_type v = cloud::cloud<Traits>::repulsion(
+                    pair.diff, pair.length_sq,
+                    cloud_repulsion_ * square(pj.prev_dt));
+                pj.new_position += v;
+                pj.move += v;
+            }
+        }
+    }
+
+    template <bool MULTI_RATE>
+    bool is_movable(const Particle& p) const {
+        return (!MULTI_RATE || p.active) && !is_static(p);
+    }
 
-            pi.pressure_balance =
-                pressure_balance_coefficient_ *
-                (pi.density_balance_corrected - pi.density0);
-            pi.pressure_repulsive =
-                pressure_repulsive_coefficient_ *
-                pi.density_repulsive_corrected;
+    template <bool MULTI_RATE>
+    void double_density_relaxation() {
+        for (int i = 0 ; i <int(particles_.size()); i++) {
+            Particle& pi = particles_[i];
+            if (!MULTI_RATE || pi.active) { pi.move = Traits::zero_vector(); }
+
+            // 係数が0なら補正密度は求めていない
+            pi.pressure_balance = 0;
+            if (USE_BALANCE_PRESSURE &&
+                (computed_ & OUTPUT_DENSITY_BALANCE_CORRECTED)) {
+                pi.pressure_balance =
+                    pressure_balance_coefficient_ *
+                    (pi.density_balance_corrected - pi.density0);
+            }
+            pi.pressure_repulsive = 0;
+            if (computed_ & OUTPUT_DENSITY_REPULSIVE_CORRECTED) {
+                pi.pressure_repulsive =
+                    pressure_repulsive_coefficient_ *
+                    pi.density_repulsive_corrected;
+            }
         }
 
         for (int i = 0 ; i <int(pairs_.size()); i++) {
@@ -486,30 +1113,66 @@ private:
             vector_type v_n = pair.diff;
             if (Traits::epsilon()<pair.length) { v_n /= pair.length; }
 
-            vector_type Di =
-                square(dt)*
-                (pi.pressure_balance *(1 - pair.length)+
-                 pi.pressure_repulsive * square(1 - pair.length))*
-                v_n;
-            vector_type Dj =
-                square(dt)*
-                (pj.pressure_balance *(1 - pair.length)+
-                 pj.pressure_repulsive * square(1 - pair.length))*
-                -v_n;
-            pj.new_position += Di / 2 - Dj / 2;
-            pj.move += Di / 2 - Dj / 2;
-            pi.new_position -= Di / 2 - Dj / 2;
-            pi.move -= Di / 2 - Dj / 2;
+            // square(1 - pair.length) == pair.k2
+            real_type pi_pressure = pi.pressure_repulsive * pair.k2;
+            real_type pj_pressure = pj.pressure_repulsive * pair.k2;
+            if (USE_BALANCE_PRESSURE) {
+                pi_pressure =
+                    pi.pressure_balance *(1 - pair.length)+ pi_pressure;
+                pj_pressure =
+                    pj.pressure_balance *(1 - pair.length)+ pj_pressure;
+            }
+
+            // 押されるのは今回進めた側だけで、その粒子のdtで押す
+            bool move_i = (!MULTI_RATE || pi.active) && !is_static(pi);
+            bool move_j = (!MULTI_RATE || pj.active) && !is_static(pj);
+            real_type dt = move_j ? pj.prev_dt : pi.prev_dt;
+            vector_type Di = square(dt)* pi_pressure * v_n;
+            vector_type Dj = square(dt)* pj_pressure * -v_n;
+            if (move_j) {
+                pj.new_position += Di / 2 - Dj / 2;
+                pj.move += Di / 2 - Dj / 2;
+            }
+            if (move_i) {
+                if (MULTI_RATE && pi.prev_dt != dt) {
+                    dt = pi.prev_dt;
+                    Di = square(dt)* pi_pressure * v_n;
+                    Dj = square(dt)* pj_pressure * -v_n;
+                }
+                pi.new_position -= Di / 2 - Dj / 2;
+                pi.move -= Di / 2 - Dj / 2;
+            }
         }
     }
 
 private:
     inline real_type square( real_type x ) { return x * x; }
 
+    template <class T>
+    StridedView<T> view(T Particle::* member) const {
+        if (particles_.empty()) { return StridedView<T>(); }
+        return StridedView<T>(
+            &(particles_[0].*member), sizeof(Particle), particles_.size());
+    }
+
 private:
     std::vector< Particle > particles_;
     std::vector< Pair >     pairs_;
+    std::vector<CloudPair>  cloud_pairs_;
+    size_t                  static_count_;  // particles_の先頭の静止粒子の数
+    bool                    static_dirty_;  // static_pairs_を作り直す
+    int                     next_id_;       // add_particleで振るid
+    std::vector<StaticPair> static_pairs_;
+    std::vector<StaticDensity> static_densities_;
+    std::vector<vector_type> pair_positions_;   // 止めている粒子の外挿した位置
+
+    NeighborSearch<Traits>  neighbor_search_;
     real_type               C_;
+    real_type               prev_dt_;
+    real_type               max_speed_;
+    unsigned int            tick_;      // updateの回数(levelの周期用)
+    int                     max_time_level_;
+    real_type               time_level_displacement_;
     real_type               src_search_radius_;
     real_type               viscosity_;
     real_type               dumping_;
@@ -517,6 +1180,17 @@ private:
     real_type               ideal_density_;
     real_type               pressure_balance_coefficient_;
     real_type               pressure_repulsive_coefficient_;
+    Solver                  solver_;
+    real_type               pbf_rest_density_;
+    int                     pbf_iterations_;
+    real_type               pbf_relaxation_;
+    std::vector<vector_type> pbf_lambda_gradients_;  // ∇C、あとでΔp
+    std::vector<real_type>  pbf_denominators_;
+    bool                    hybrid_;
+    real_type               cloud_repulsion_;
+    int                     cloud_cooldown_;
+    unsigned int            outputs_;
+    unsigned int            computed_;  // 直近のupdateで求めた値(Output)
 
 };
 
@@ -527,6 +1201,7 @@ struct SPH_Traits_D3DX_2D {
     typedef D3DXVECTOR2 vector_type;
     typedef struct {} load_type;
     enum { DIMENSION = 2 };
+    enum { USE_GRAVITY = 1, USE_BALANCE_PRESSURE = 1 };
 
     static real_type epsilon() {
         return 1.0e-6f;
@@ -545,7 +1220,7 @@ struct SPH_Traits_D3DX_2D {
     }
 
     static int coord(real_type n) {
-        return int(floor(n));
+        return neighbor_search_coord(n);
     }
     static void make_coords(int a[2], const vector_type& v) {
         a[0] = coord(v.x);
@@ -555,12 +1230,8 @@ struct SPH_Traits_D3DX_2D {
         v.x = a[0];
         v.y = a[1];
     }
-    static int hash(const int a[2], int table_size) {
-        // large prime numbers
-        const int p1 = 73856093;
-        const int p2 = 19349663;
-
-        return size_t((a[0] * p1)^(a[1] * p2))% table_size;
+    static int group(const load_type&) {
+        return -1;
     }
 
 };
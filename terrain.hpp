@@ -0,0 +1,526 @@
+// 2026/10/19
+
+/*!
+	@file	  terrain.hpp
+	@brief	  <Tv>
+
+	n`RpC̕i
+	Board̒P}bvTiledTerrain̊e^CŋL
+*/
+
+#ifndef TERRAIN_HPP_
+#define TERRAIN_HPP_
+
+#include "trapezoidal_map.hpp"
+#include "pathview.hpp"
+#include "color.hpp"
+#include "array_view.hpp"
+#include "radix_sort.hpp"
+#include "performance_counter.hpp"
+#include <boost/random.hpp>
+#include <cmath>
+
+struct TerrainSegmentProperty {
+    int upper_cell_index;
+    int lower_cell_index;
+};
+
+// {mCZ̕_(_)
+// constraintgci::Documentɂꂾ
+struct TerrainCellSite {
+    D3DXVECTOR2 p0;
+    D3DXVECTOR2 p1;
+    int         is_segment;
+};
+
+// }̐(LbVTrapezoidalMap蒼Ƃp)
+struct TerrainSegment {
+    D3DXVECTOR2             p0;
+    D3DXVECTOR2             p1;
+    TerrainSegmentProperty  sp;
+};
+
+// a0-a1b0-b1EڐG邩([_̋LdȂ܂)
+inline bool terrain_segments_touch(
+    const D3DXVECTOR2& a0, const D3DXVECTOR2& a1,
+    const D3DXVECTOR2& b0, const D3DXVECTOR2& b1) {
+    auto cross = [](
+        const D3DXVECTOR2& o, const D3DXVECTOR2& p, const D3DXVECTOR2& q) {
+        return (p.x - o.x) * (q.y - o.y) - (p.y - o.y) * (q.x - o.x);
+    };
+    // po-q̊Oڋ`ɓ邩(꒼̂Ƃg)
+    auto within = [](
+        const D3DXVECTOR2& o, const D3DXVECTOR2& q, const D3DXVECTOR2& p) {
+        return (std::min)(o.x, q.x) <= p.x && p.x <= (std::max)(o.x, q.x) &&
+            (std::min)(o.y, q.y) <= p.y && p.y <= (std::max)(o.y, q.y);
+    };
+
+    float d0 = cross(a0, a1, b0);
+    float d1 = cross(a0, a1, b1);
+    float d2 = cross(b0, b1, a0);
+    float d3 = cross(b0, b1, a1);
+    if (((0 < d0 && d1 < 0) || (d0 < 0 && 0 < d1)) &&
+        ((0 < d2 && d3 < 0) || (d2 < 0 && 0 < d3))) {
+        return true;
+    }
+    return
+        (d0 == 0 && within(a0, a1, b0)) ||
+        (d1 == 0 && within(a0, a1, b1)) ||
+        (d2 == 0 && within(b0, b1, a0)) ||
+        (d3 == 0 && within(b0, b1, a1));
+}
+
+typedef TrapezoidalMap<float, TerrainSegmentProperty>        TerrainMap;
+typedef TrapezoidalMapMachine<float, TerrainSegmentProperty> TerrainMachine;
+
+// TrapezoidalMap̍őT[̏ FACTOR * log2()
+// }ςč蒼(REBUILDS܂)
+const float TERRAIN_DEPTH_FACTOR    = 5.0f;
+const int   TERRAIN_MAX_REBUILDS    = 8;
+
+inline int terrain_depth_bound(size_t segment_count) {
+    if (TERRAIN_DEPTH_FACTOR <= 0) { return 0; }
+    return int(TERRAIN_DEPTH_FACTOR * log2(float(segment_count + 2)));
+}
+
+// Fisher-Yates(킪Ȃ疈񓯂n`R[hɂȂ)
+inline void shuffle_terrain_segments(
+    std::vector<TerrainSegment>& segments, unsigned int seed) {
+    boost::mt19937 gen(seed);
+    for (size_t i = segments.size() ; 1 < i ; i--) {
+        boost::uniform_int<size_t> dst(0, i - 1);
+        std::swap(segments[i - 1], segments[dst(gen)]);
+    }
+}
+
+// segments̏tm֓
+// ő[max_depth𒴂ςăVbtA蒼
+// (max_depth <= 0Ȃ1񂾂)Bsegments͍ŌɎgɂȂ
+// insert(Y, )󂯎tmɑ}
+template <class Insert>
+TerrainMap::DepthStats build_terrain_map(
+    TerrainMap&                     tm,
+    std::vector<TerrainSegment>&    segments,
+    int                             max_depth,
+    Insert                          insert) {
+    PerformanceCounter pc(false);
+
+    TerrainMap::DepthStats ds;
+    for (int attempt = 0 ; ; attempt++) {
+        if (0 < attempt) {
+            tm.clear();
+            shuffle_terrain_segments(segments, attempt);
+        }
+        for (size_t i = 0 ; i < segments.size() ; i++) {
+            insert(i, segments[i]);
+        }
+        ds = tm.depth_stats();
+        if (max_depth <= 0 || ds.max_depth <= max_depth ||
+            TERRAIN_MAX_REBUILDS <= attempt) {
+            break;
+        }
+        dprintf("trapezoidal map: depth %d > %d, rebuilding\n",
+                ds.max_depth, max_depth);
+    }
+
+    dprintf("trapezoidal map: %d segments, depth max %d avg %f, %f sec\n",
+            int(segments.size()), ds.max_depth, ds.average_depth, pc());
+    return ds;
+}
+
+template <class Document>
+TerrainCellSite make_terrain_cell_site(const Document& doc, int cell) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+    const typename Document::Site& site =
+        doc.site_array()[doc.cell_site_index(cell)];
+
+    TerrainCellSite cs;
+    cs.is_segment = site.is_segment ? 1 : 0;
+    cs.p0 = vertices[site.p0];
+    cs.p1 = site.is_segment ? vertices[site.p1] : cs.p0;
+    return cs;
+}
+
+// Z̕([̒_ԍl߂L[ŕׂďd)
+struct TerrainEdge {
+    boost::uint64_t key;    // (_ԍ << vertex_bits) | 傫_ԍ
+    int             side;   // cells̒̈ʒu * 2 + invert
+};
+
+// cells̃Z̕ӂL[ɕׂ
+// Ȃ̂œӂ̓Ẑ܂ܕ
+// invert͕ӂ(x, y)̎ŋt̂Ƃ
+template <class Document>
+void sort_terrain_edges(
+    const Document&             doc,
+    const ArrayView<int>&       cells,
+    std::vector<TerrainEdge>&   edges,
+    int&                        vertex_bits) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+
+    vertex_bits = 0;
+    while ((size_t(1) << vertex_bits) < vertices.size()) {
+        vertex_bits++;
+    }
+
+    size_t edge_count = 0;
+    for (size_t i = 0 ; i <cells.size() ; i++) {
+        edge_count += doc.cell_vertex_indices(cells[i]).size();
+    }
+
+    edges.clear();
+    edges.reserve(edge_count);
+    for (size_t i = 0 ; i <cells.size() ; i++) {
+        ArrayView<int> v = doc.cell_vertex_indices(cells[i]);
+
+        for (size_t j = 0 ; j <v.size(); j++) {
+            int index0 = v[j];
+            int index1 = v[(j+1)% v.size()];
+
+            // lexicographical compare
+            const D3DXVECTOR2& p0 = vertices[index0];
+            const D3DXVECTOR2& p1 = vertices[index1];
+            bool invert = !(p0.x < p1.x || (p0.x == p1.x && p0.y < p1.y));
+
+            if (index1 <index0) { std::swap(index0, index1); }
+
+            TerrainEdge e;
+            e.key = (boost::uint64_t(index0) << vertex_bits) | index1;
+            e.side = int(i) * 2 + (invert ? 1 : 0);
+            edges.push_back(e);
+        }
+    }
+
+    std::vector<TerrainEdge> tmp;
+    radix_sort(edges, tmp, vertex_bits * 2);
+}
+
+// cells̃Z̕ӂdȂW߂ăVbt
+// sp̃Zԍcells̈ʒu
+// Documentgci::Documentgci::MappedDocument
+template <class Document>
+void collect_terrain_segments(
+    const Document&             doc,
+    const ArrayView<int>&       cells,
+    std::vector<TerrainSegment>& segments) {
+    PerformanceCounter pc(false);
+
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+
+    std::vector<TerrainEdge> edges;
+    int vertex_bits;
+    sort_terrain_edges(doc, cells, edges, vertex_bits);
+    const boost::uint64_t vertex_mask =
+        (boost::uint64_t(1) << vertex_bits) - 1;
+
+    // L[̘A܂Ƃ߂(̃Z)
+    segments.clear();
+    segments.reserve(edges.size() / 2 + 1);
+    for (size_t i = 0 ; i < edges.size() ; ) {
+        TerrainSegment ts;
+        ts.p0 = vertices[size_t(edges[i].key >> vertex_bits)];
+        ts.p1 = vertices[size_t(edges[i].key & vertex_mask)];
+        ts.sp.upper_cell_index = -1;
+        ts.sp.lower_cell_index = -1;
+
+        boost::uint64_t key = edges[i].key;
+        for (; i < edges.size() && edges[i].key == key ; i++) {
+            int cell = edges[i].side >> 1;
+            if (edges[i].side & 1) {
+                ts.sp.upper_cell_index = cell;
+            } else {
+                ts.sp.lower_cell_index = cell;
+            }
+        }
+        segments.push_back(ts);
+    }
+
+    shuffle_terrain_segments(segments, 0);
+
+    dprintf("terrain edges: %d edges, %d segments, %f sec\n",
+            int(edges.size()), int(segments.size()), pc());
+}
+
+// Z̗֊s(MoveTo + LineTo*n)
+template <class Document>
+void post_cell_outline(
+    const Document& doc, int cell, std::vector<Primitive>& pb) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+    ArrayView<int> v = doc.cell_vertex_indices(cell);
+
+    Primitive p;
+    p.opcode = Primitive::MoveTo;
+    p.operands[0] = vertices[v.back()].x;
+    p.operands[1] = vertices[v.back()].y;
+    pb.push_back(p);
+    for (size_t j = 0 ; j <v.size(); j++) {
+        p.opcode = Primitive::LineTo;
+        p.operands[0] = vertices[v[j]].x;
+        p.operands[1] = vertices[v[j]].y;
+        pb.push_back(p);
+    }
+}
+
+// Z̓h((MoveTo + Triangle)*n)
+template <class Document>
+void post_cell_fill(
+    const Document& doc, int cell, std::vector<Primitive>& pb) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+    ArrayView<typename Document::Triangle> v = doc.cell_triangles(cell);
+
+    Primitive p;
+    for (size_t j = 0 ; j <v.size(); j++) {
+        p.opcode = Primitive::MoveTo;
+        p.operands[0] = vertices[v[j].v0].x;
+        p.operands[1] = vertices[v[j].v0].y;
+        pb.push_back(p);
+
+        p.opcode = Primitive::Triangle;
+        p.operands[0] = vertices[v[j].v1].x;
+        p.operands[1] = vertices[v[j].v1].y;
+        p.operands[2] = vertices[v[j].v2].x;
+        p.operands[3] = vertices[v[j].v2].y;
+        pb.push_back(p);
+    }
+}
+
+inline void post_color(
+    std::vector<Primitive>& pb, float r, float g, float b) {
+    Primitive p;
+    p.opcode = Primitive::Color;
+    p.operands[0] = r;
+    p.operands[1] = g;
+    p.operands[2] = b;
+    pb.push_back(p);
+}
+
+// Z̐F(ɋ߂͔̂΂A0xRRGGBB)
+inline unsigned long next_terrain_color(int& color_index) {
+    unsigned long color;
+    do {
+        color = get_color(color_index++);
+    } while (get_color_distance(0xffffff, color)<0.1f);
+    return color;
+}
+
+inline void post_rgb(std::vector<Primitive>& pb, unsigned long color) {
+    float r =((color & 0xff0000) >> 16)/ 255.0f;
+    float g =((color & 0x00ff00) >>  8)/ 255.0f;
+    float b =((color & 0x0000ff))/ 255.0f;
+    post_color(pb, r, g, b);
+}
+
+inline void post_random_color(std::vector<Primitive>& pb, int& color_index) {
+    post_rgb(pb, next_terrain_color(color_index));
+}
+
+// `p̃CfbNXtbV
+// PrimitiveƈႢA֊s̒_̓ZԂŋLAׂ荇Z̋E
+// 1{Bh͐FZƂȂ̂Œ_̓Z̒łL
+struct TerrainMeshVertex {
+    D3DXVECTOR2     p;
+    boost::uint32_t color;  // ARGB
+};
+
+struct TerrainMesh {
+    TerrainMesh() : version(0) { clear(); }
+
+    // ֊s
+    std::vector<D3DXVECTOR2>            edge_vertices;
+    std::vector<boost::uint32_t>        edge_indices;       // 21
+    std::vector<TerrainSegmentProperty> edge_cells;         // ӂ̗̃Z
+
+    // h
+    std::vector<TerrainMeshVertex>      fill_vertices;
+    std::vector<boost::uint32_t>        fill_indices;       // 31Op`
+    std::vector<int>                    cell_fill_offsets;  // ZƂ͈̔
+
+    // _65536ȉ̂Ƃfinish_terrain_mesh
+    std::vector<boost::uint16_t>        edge_indices16;
+    std::vector<boost::uint16_t>        fill_indices16;
+
+    // clear/finish_terrain_mesĥтɐi(`摤̃LbVp)
+    unsigned int                        version;
+
+    void clear() {
+        edge_vertices.clear();
+        edge_indices.clear();
+        edge_cells.clear();
+        fill_vertices.clear();
+        fill_indices.clear();
+        cell_fill_offsets.assign(1, 0);
+        edge_indices16.clear();
+        fill_indices16.clear();
+        version++;
+    }
+
+    // CPUŎ_ƃCfbNX̃oCg
+    size_t byte_size() const {
+        return edge_vertices.size() * sizeof(D3DXVECTOR2) +
+            fill_vertices.size() * sizeof(TerrainMeshVertex) +
+            (edge_indices16.empty() ?
+             edge_indices.size() * 4 : edge_indices16.size() * 2) +
+            (fill_indices16.empty() ?
+             fill_indices.size() * 4 : fill_indices16.size() * 2);
+    }
+};
+
+// 16bitCfbNX蒼(bVςĂ)
+inline void finish_terrain_mesh(TerrainMesh& mesh) {
+    mesh.version++;
+    mesh.edge_indices16.clear();
+    mesh.fill_indices16.clear();
+    if (0x10000 < mesh.edge_vertices.size() ||
+        0x10000 < mesh.fill_vertices.size()) {
+        return;
+    }
+    mesh.edge_indices16.assign(
+        mesh.edge_indices.begin(), mesh.edge_indices.end());
+    mesh.fill_indices16.assign(
+        mesh.fill_indices.begin(), mesh.fill_indices.end());
+}
+
+// cells̃Z烁bV
+// Fpost_random_colorƓőI(color_indexi߂)
+// edge_cells̃Zԍcells̈ʒu
+template <class Document>
+void build_terrain_mesh(
+    const Document&         doc,
+    const ArrayView<int>&   cells,
+    int&                    color_index,
+    TerrainMesh&            mesh) {
+    PerformanceCounter pc(false);
+
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+    mesh.clear();
+
+    // ֊s: collect_terrain_segmentsƓׂďd܂Ƃ߂
+    std::vector<TerrainEdge> edges;
+    int vertex_bits;
+    sort_terrain_edges(doc, cells, edges, vertex_bits);
+    const boost::uint64_t vertex_mask =
+        (boost::uint64_t(1) << vertex_bits) - 1;
+
+    std::vector<int> remap(vertices.size(), -1);
+    mesh.edge_indices.reserve(edges.size());
+    mesh.edge_cells.reserve(edges.size() / 2 + 1);
+    for (size_t i = 0 ; i < edges.size() ; ) {
+        size_t ends[2] = {
+            size_t(edges[i].key >> vertex_bits),
+            size_t(edges[i].key & vertex_mask)
+        };
+        for (int j = 0 ; j < 2 ; j++) {
+            int& k = remap[ends[j]];
+            if (k < 0) {
+                k = int(mesh.edge_vertices.size());
+                mesh.edge_vertices.push_back(vertices[ends[j]]);
+            }
+            mesh.edge_indices.push_back(k);
+        }
+
+        TerrainSegmentProperty sp;
+        sp.upper_cell_index = -1;
+        sp.lower_cell_index = -1;
+        boost::uint64_t key = edges[i].key;
+        for (; i < edges.size() && edges[i].key == key ; i++) {
+            int cell = edges[i].side >> 1;
+            if (edges[i].side & 1) {
+                sp.upper_cell_index = cell;
+            } else {
+                sp.lower_cell_index = cell;
+            }
+        }
+        mesh.edge_cells.push_back(sp);
+    }
+
+    // h: Z̗֊s̒_ɐFtĎOp`
+    for (size_t i = 0 ; i < cells.size() ; i++) {
+        ArrayView<int> v = doc.cell_vertex_indices(cells[i]);
+        ArrayView<typename Document::Triangle> t =
+            doc.cell_triangles(cells[i]);
+
+        boost::uint32_t color =
+            0x40000000 | boost::uint32_t(next_terrain_color(color_index));
+        int base = int(mesh.fill_vertices.size());
+        for (size_t j = 0 ; j < v.size() ; j++) {
+            TerrainMeshVertex mv;
+            mv.p = vertices[v[j]];
+            mv.color = color;
+            mesh.fill_vertices.push_back(mv);
+        }
+
+        for (size_t j = 0 ; j < t.size() ; j++) {
+            int tv[3] = { t[j].v0, t[j].v1, t[j].v2 };
+            for (int k = 0 ; k < 3 ; k++) {
+                size_t l = 0;
+                while (l < v.size() && v[l] != tv[k]) { l++; }
+                if (l == v.size()) {
+                    // ֊sɂȂ_(ʂ͂Ȃ)
+                    TerrainMeshVertex mv;
+                    mv.p = vertices[tv[k]];
+                    mv.color = color;
+                    l = mesh.fill_vertices.size() - base;
+                    mesh.fill_vertices.push_back(mv);
+                }
+                mesh.fill_indices.push_back(base + int(l));
+            }
+        }
+        mesh.cell_fill_offsets.push_back(int(mesh.fill_indices.size()));
+    }
+
+    finish_terrain_mesh(mesh);
+
+    dprintf("terrain mesh: %d edge vertices, %d edges, "
+            "%d fill vertices, %d triangles, %d bytes, %f sec\n",
+            int(mesh.edge_vertices.size()), int(mesh.edge_cells.size()),
+            int(mesh.fill_vertices.size()), int(mesh.fill_indices.size() / 3),
+            int(mesh.byte_size()), pc());
+}
+
+inline D3DXVECTOR2 nearest_point_on_line(
+    const D3DXVECTOR2& p0,
+    const D3DXVECTOR2& p1,
+    const D3DXVECTOR2& q) {
+    float dx = p1.x - p0.x;
+    float dy = p1.y - p0.y;
+    float a = dx * dx + dy * dy;
+    if (a == 0) { return p0; }
+
+    float b = dx *(p0.x - q.x)+ dy *(p0.y - q.y);
+    float t = -(b / a);
+    if (t <0.0f) { t = 0.0f; }
+    if (1.0f <t) { t = 1.0f; }
+    return D3DXVECTOR2(p0.x + dx * t, p0.y + dy * t);
+}
+
+// qvZ̒ȂZ̕_֔񂹂
+inline D3DXVECTOR2 apply_terrain_constraint(
+    const TerrainMachine&               tmm,
+    const ArrayView<TerrainCellSite>&   cell_sites,
+    const D3DXVECTOR2&                  qv) {
+    TerrainMap::Point q;
+    q.x(qv.x);
+    q.y(qv.y);
+
+    int score;
+    TerrainSegmentProperty tsp;
+    TerrainSegmentProperty bsp;
+
+    if (tmm.find(q, score, tsp, bsp)) {
+        if (0 <= tsp.lower_cell_index) {
+            const TerrainCellSite& site = cell_sites[tsp.lower_cell_index];
+
+            D3DXVECTOR2 qv2;
+            if (site.is_segment) {
+                qv2 = nearest_point_on_line(site.p0, site.p1, qv);
+            } else {
+                qv2 = site.p0;
+            }
+
+            return (qv2 - qv)* 0.5f + qv;
+        }
+    }
+    return qv;
+}
+
+#endif // TERRAIN_HPP_
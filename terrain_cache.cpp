@@ -0,0 +1,128 @@
+// 2026/10/19
+
+#include "terrain_cache.hpp"
+#include <fstream>
+#include <cstring>
+
+namespace {
+
+const char TERRAIN_CACHE_MAGIC[4] = { 'P', 'T', 'M', 'C' };
+
+// ZNV擪̃ACg(float̓ǂݏoɕKvȕ傫)
+const size_t SECTION_ALIGNMENT = 16;
+
+size_t align_up(size_t n) {
+    return (n + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+}
+
+boost::uint64_t fnv1a(const char* p, size_t n) {
+    boost::uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0 ; i < n ; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+}
+
+/*============================================================================
+ *
+ * class TerrainCache 
+ *
+ * 
+ *
+ *==========================================================================*/
+//<<<<<<<<<< TerrainCache
+
+//****************************************************************
+// load
+bool TerrainCache::load(const char* filename, boost::uint64_t source_hash) {
+    if (!file_.open(filename)) { return false; }
+
+    if (file_.size() < sizeof(Header)) { file_.close(); return false; }
+
+    const Header* h = header();
+    if (memcmp(h->magic, TERRAIN_CACHE_MAGIC, 4) != 0 ||
+        h->version != TERRAIN_CACHE_VERSION ||
+        h->source_hash != source_hash) {
+        file_.close();
+        return false;
+    }
+
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        const SectionEntry& e = h->sections[i];
+        if (file_.size() < size_t(e.offset) + e.size ||
+            e.offset % SECTION_ALIGNMENT != 0) {
+            file_.close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//>>>>>>>>>> TerrainCache
+
+/*============================================================================
+ *
+ * class TerrainCache::Writer 
+ *
+ * 
+ *
+ *==========================================================================*/
+//<<<<<<<<<< TerrainCache::Writer
+
+//****************************************************************
+// add
+void TerrainCache::Writer::add(
+    Section s, const void* p, size_t element_size, size_t count) {
+    Entry& e = entries_[s];
+    e.element_size = element_size;
+    e.bytes.assign((const char*)p, (const char*)p + element_size * count);
+}
+
+//****************************************************************
+// write
+bool TerrainCache::Writer::write(
+    const char* filename, boost::uint64_t source_hash) const {
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TERRAIN_CACHE_MAGIC, 4);
+    h.version = TERRAIN_CACHE_VERSION;
+    h.source_hash = source_hash;
+
+    size_t offset = align_up(sizeof(Header));
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        h.sections[i].offset = boost::uint32_t(offset);
+        h.sections[i].size = boost::uint32_t(entries_[i].bytes.size());
+        h.sections[i].element_size = boost::uint32_t(entries_[i].element_size);
+        offset = align_up(offset + entries_[i].bytes.size());
+    }
+
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs) { return false; }
+
+    static const char padding[SECTION_ALIGNMENT] = { 0 };
+    ofs.write((const char*)&h, sizeof(h));
+    size_t written = sizeof(h);
+    for (int i = 0 ; i < SECTION_COUNT ; i++) {
+        ofs.write(padding, h.sections[i].offset - written);
+        if (!entries_[i].bytes.empty()) {
+            ofs.write(&entries_[i].bytes[0], entries_[i].bytes.size());
+        }
+        written = h.sections[i].offset + entries_[i].bytes.size();
+    }
+
+    return bool(ofs);
+}
+
+//>>>>>>>>>> TerrainCache::Writer
+
+//****************************************************************
+// hash_file
+boost::uint64_t hash_file(const char* filename) {
+    MappedFile f;
+    if (!f.open(filename)) { return 0; }
+    return fnv1a(f.data(), f.size());
+}
@@ -0,0 +1,101 @@
+// 2026/10/19
+
+/*!
+	@file	  terrain_cache.hpp
+	@brief	  <Tv>
+
+	RpCςݒn`(TrapezoidalMapMachinẽR[h)̃oCiLbV
+	.gci̓ẽnbVL[ɂAvmmap܂܎g
+*/
+
+#ifndef TERRAIN_CACHE_HPP_
+#define TERRAIN_CACHE_HPP_
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "mapped_file.hpp"
+#include "array_view.hpp"
+
+const boost::uint32_t TERRAIN_CACHE_VERSION = 3;
+
+class TerrainCache {
+public:
+    enum Section {
+        Code,           // TrapezoidalMapMachinẽR[h
+        Segments,       // }̐Ƒ(TrapezoidalMapč\zp)
+        Primitives,     // `pPrimitive
+        CellSites,      // {mCZƂ̃TCg
+        CellPrimitives, // ZƂPrimitive͈̔(n`ҏWp)
+        MeshEdgeVertices,       // TerrainMesh
+        MeshEdgeIndices,
+        MeshEdgeCells,
+        MeshFillVertices,
+        MeshFillIndices,
+        MeshCellFillOffsets,
+        SECTION_COUNT
+    };
+
+    struct SectionEntry {
+        boost::uint32_t offset;
+        boost::uint32_t size;           // bytes
+        boost::uint32_t element_size;
+    };
+
+    struct Header {
+        char            magic[4];
+        boost::uint32_t version;
+        boost::uint64_t source_hash;
+        SectionEntry    sections[SECTION_COUNT];
+    };
+
+    class Writer {
+    public:
+        template <class T>
+        void add(Section s, const std::vector<T>& v) {
+            add(s, v.empty() ? nullptr : &v[0], sizeof(T), v.size());
+        }
+        void add(Section s, const void* p, size_t element_size, size_t count);
+
+        bool write(const char* filename, boost::uint64_t source_hash) const;
+
+    private:
+        struct Entry {
+            Entry() : element_size(0) {}
+
+            size_t              element_size;
+            std::vector<char>   bytes;
+        };
+        Entry entries_[SECTION_COUNT];
+
+    };
+
+public:
+    TerrainCache() {}
+    ~TerrainCache() {}
+
+    // wb_ĂEo[WnbVႤꍇfalse
+    bool load(const char* filename, boost::uint64_t source_hash);
+    void close() { file_.close(); }
+
+    bool is_open() const { return file_.is_open(); }
+
+    template <class T>
+    ArrayView<T> section(Section s) const {
+        const SectionEntry& e = header()->sections[s];
+        if (e.element_size != sizeof(T)) { return ArrayView<T>(); }
+        return ArrayView<T>(
+            (const T*)(file_.data() + e.offset), e.size / sizeof(T));
+    }
+
+private:
+    const Header* header() const { return (const Header*)file_.data(); }
+
+private:
+    MappedFile file_;
+
+};
+
+// FNV-1a 64bit
+boost::uint64_t hash_file(const char* filename);
+
+#endif // TERRAIN_CACHE_HPP_
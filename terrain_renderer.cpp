@@ -0,0 +1,121 @@
+// 2026/10/19
+
+#include "terrain_renderer.hpp"
+#include <algorithm>
+#include <climits>
+
+/*============================================================================
+ *
+ * class TerrainRenderer
+ *
+ *
+ *
+ *==========================================================================*/
+//<<<<<<<<<< TerrainRenderer
+
+//****************************************************************
+// render
+void TerrainRenderer::render(
+    LPDIRECT3DDEVICE9   device,
+    const TerrainMesh&  mesh) {
+    device->SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
+    device->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
+    device->SetRenderState(D3DRS_ZENABLE, D3DZB_FALSE);
+    device->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
+    device->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
+    device->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
+    device->SetRenderState(D3DRS_DESTBLEND, D3DBLEND_INVSRCALPHA);
+    device->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG1);
+    device->SetTextureStageState(0, D3DTSS_COLORARG1, D3DTA_DIFFUSE);
+    device->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG1);
+    device->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_DIFFUSE);
+
+    if (cached_mesh_ != &mesh || cached_version_ != mesh.version) {
+        // ֊sPathviewRendererColor(0, 0, 0)Ɠ
+        const DWORD edge_color = D3DCOLOR_ARGB(64, 0, 0, 0);
+
+        edge_vertices_.resize(mesh.edge_vertices.size());
+        for (size_t i = 0 ; i < mesh.edge_vertices.size() ; i++) {
+            edge_vertices_[i].p = vec4(mesh.edge_vertices[i]);
+            edge_vertices_[i].c = edge_color;
+        }
+        fill_vertices_.resize(mesh.fill_vertices.size());
+        for (size_t i = 0 ; i < mesh.fill_vertices.size() ; i++) {
+            fill_vertices_[i].p = vec4(mesh.fill_vertices[i].p);
+            fill_vertices_[i].c = mesh.fill_vertices[i].color;
+        }
+        expanded_edge_vertices_.clear();
+        expanded_fill_vertices_.clear();
+        cached_mesh_ = &mesh;
+        cached_version_ = mesh.version;
+    }
+
+    D3DCAPS9 caps;
+    device->GetDeviceCaps(&caps);
+
+    device->SetFVF(vertex_type::format);
+    draw_indexed(
+        device, caps, D3DPT_TRIANGLELIST, 3,
+        fill_vertices_, mesh.fill_indices, mesh.fill_indices16,
+        expanded_fill_vertices_);
+    draw_indexed(
+        device, caps, D3DPT_LINELIST, 2,
+        edge_vertices_, mesh.edge_indices, mesh.edge_indices16,
+        expanded_edge_vertices_);
+}
+
+//----------------------------------------------------------------
+// draw_indexed
+void TerrainRenderer::draw_indexed(
+    LPDIRECT3DDEVICE9                   device,
+    const D3DCAPS9&                     caps,
+    D3DPRIMITIVETYPE                    type,
+    int                                 vertices_per_primitive,
+    const std::vector<vertex_type>&     vertices,
+    const std::vector<boost::uint32_t>& indices,
+    const std::vector<boost::uint16_t>& indices16,
+    std::vector<vertex_type>&           expanded) {
+    int count = int(indices.size()) / vertices_per_primitive;
+    if (count == 0) { return; }
+
+    // 1ɕ`鐔̓foCXMaxPrimitiveCount܂
+    int max_count = int((std::min)(caps.MaxPrimitiveCount, DWORD(INT_MAX)));
+    if (max_count < 1) { max_count = 1; }
+
+    // MaxVertexIndex𒴂钸_̓CfbNXňȂ̂
+    // _WJDrawPrimitiveUPŕ`(ÂfoCXp)
+    if (caps.MaxVertexIndex < vertices.size() - 1) {
+        if (expanded.empty()) {
+            expanded.resize(indices.size());
+            for (size_t i = 0 ; i < indices.size() ; i++) {
+                expanded[i] = vertices[indices[i]];
+            }
+        }
+        for (int i = 0 ; i < count ; i += max_count) {
+            device->DrawPrimitiveUP(
+                type, (std::min)(count - i, max_count),
+                &expanded[i * vertices_per_primitive],
+                sizeof(vertex_type));
+        }
+        return;
+    }
+
+    // 16bitĂ΂g
+    for (int i = 0 ; i < count ; i += max_count) {
+        int n = (std::min)(count - i, max_count);
+        int first = i * vertices_per_primitive;
+        if (!indices16.empty()) {
+            device->DrawIndexedPrimitiveUP(
+                type, 0, UINT(vertices.size()), n,
+                &indices16[first], D3DFMT_INDEX16,
+                &vertices[0], sizeof(vertex_type));
+        } else {
+            device->DrawIndexedPrimitiveUP(
+                type, 0, UINT(vertices.size()), n,
+                &indices[first], D3DFMT_INDEX32,
+                &vertices[0], sizeof(vertex_type));
+        }
+    }
+}
+
+//>>>>>>>>>> TerrainRenderer
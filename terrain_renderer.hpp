@@ -0,0 +1,56 @@
+// 2026/10/19
+
+/*!
+	@file	  terrain_renderer.hpp
+	@brief	  <Tv>
+
+	TerrainMesh̕`
+	PathviewRendererƓڂCfbNXtŕ`
+*/
+
+#ifndef TERRAIN_RENDERER_HPP_
+#define TERRAIN_RENDERER_HPP_
+
+#include "zw/d3dfvf.hpp"
+#include "terrain.hpp"
+
+class TerrainRenderer {
+private:
+    typedef zw::fvf::vertex< (D3DFVF_XYZRHW|D3DFVF_DIFFUSE) > vertex_type;
+
+public:
+    TerrainRenderer() : cached_mesh_(nullptr), cached_version_(0) {}
+    ~TerrainRenderer() {}
+
+    void render(LPDIRECT3DDEVICE9 device, const TerrainMesh& mesh);
+
+private:
+    void draw_indexed(
+        LPDIRECT3DDEVICE9                   device,
+        const D3DCAPS9&                     caps,
+        D3DPRIMITIVETYPE                    type,
+        int                                 vertices_per_primitive,
+        const std::vector<vertex_type>&     vertices,
+        const std::vector<boost::uint32_t>& indices,
+        const std::vector<boost::uint16_t>& indices16,
+        std::vector<vertex_type>&           expanded);
+
+    D3DXVECTOR4 vec4(const D3DXVECTOR2& v) {
+        return D3DXVECTOR4(v.x, v.y, 0, 1);
+    }
+
+private:
+    std::vector<vertex_type>    edge_vertices_;
+    std::vector<vertex_type>    fill_vertices_;
+
+    // MaxVertexIndexȂfoCXł
+    std::vector<vertex_type>    expanded_edge_vertices_;
+    std::vector<vertex_type>    expanded_fill_vertices_;
+
+    // meshversionςƂ_蒼
+    const TerrainMesh*          cached_mesh_;
+    unsigned int                cached_version_;
+
+};
+
+#endif // TERRAIN_RENDERER_HPP_
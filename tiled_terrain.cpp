@@ -0,0 +1,372 @@
+// 2026/10/19
+
+#include "tiled_terrain.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+
+namespace {
+
+struct Bounds {
+    Bounds() : minx(FLT_MAX), miny(FLT_MAX), maxx(-FLT_MAX), maxy(-FLT_MAX) {}
+
+    void add(const D3DXVECTOR2& p) {
+        minx = (std::min)(minx, p.x);
+        miny = (std::min)(miny, p.y);
+        maxx = (std::max)(maxx, p.x);
+        maxy = (std::max)(maxy, p.y);
+    }
+
+    float minx;
+    float miny;
+    float maxx;
+    float maxy;
+};
+
+Bounds cell_bounds(const gci::MappedDocument& doc, int cell) {
+    ArrayView<D3DXVECTOR2> vertices = doc.vertex_array();
+    Bounds b;
+    for (int i: doc.cell_vertex_indices(cell)) {
+        b.add(vertices[i]);
+    }
+    return b;
+}
+
+}
+
+/*============================================================================
+ *
+ * class TiledTerrain
+ *
+ *
+ *
+ *==========================================================================*/
+//<<<<<<<<<< TiledTerrain
+
+//****************************************************************
+// constructor
+TiledTerrain::TiledTerrain(float tile_size, size_t max_loaded_tiles)
+    : tile_size_(tile_size), max_loaded_tiles_(max_loaded_tiles),
+      left_(0), top_(0), columns_(0), rows_(0),
+      clock_(0), loaded_count_(0), footprint_clock_(UINT_MAX),
+      primitives_dirty_(false), primitives_version_(0) {
+}
+
+//****************************************************************
+// open
+bool TiledTerrain::open(const char* filename) {
+    close();
+    if (!doc_.open(filename)) { return false; }
+
+    Bounds world;
+    for (const D3DXVECTOR2& p: doc_.vertex_array()) {
+        world.add(p);
+    }
+    if (doc_.vertex_array().empty()) {
+        close();
+        return false;
+    }
+
+    left_ = world.minx;
+    top_ = world.miny;
+    columns_ = int((world.maxx - world.minx) / tile_size_) + 1;
+    rows_ = int((world.maxy - world.miny) / tile_size_) + 1;
+    tiles_.reset(new Tile[columns_ * rows_]);
+
+    // Zbounding box̂^CɐU蕪(2pX)
+    std::vector<int> counts(columns_ * rows_ + 1, 0);
+    for (int pass = 0 ; pass < 2 ; pass++) {
+        for (size_t i = 0 ; i < doc_.cell_count() ; i++) {
+            Bounds b = cell_bounds(doc_, int(i));
+            int c0 = column_of(b.minx);
+            int c1 = column_of(b.maxx);
+            int r0 = row_of(b.miny);
+            int r1 = row_of(b.maxy);
+            for (int r = r0 ; r <= r1 ; r++) {
+                for (int c = c0 ; c <= c1 ; c++) {
+                    int t = r * columns_ + c;
+                    if (pass == 0) {
+                        counts[t + 1]++;
+                    } else {
+                        tile_cells_[counts[t]++] = int(i);
+                    }
+                }
+            }
+        }
+
+        if (pass == 0) {
+            for (size_t t = 1 ; t < counts.size() ; t++) {
+                counts[t] += counts[t - 1];
+            }
+            tile_cell_offsets_ = counts;
+            tile_cells_.resize(counts.back());
+        }
+    }
+
+    dprintf("tiled terrain: %d x %d tiles, %d cells\n",
+            columns_, rows_, int(doc_.cell_count()));
+    return true;
+}
+
+//****************************************************************
+// close
+void TiledTerrain::close() {
+    // [J[doc_ǂݏI܂ő҂
+    for (int index: pending_) {
+        tiles_[index].pending.wait();
+    }
+    pending_.clear();
+    footprint_clock_ = UINT_MAX;
+
+    doc_.close();
+    tiles_.reset();
+    columns_ = 0;
+    rows_ = 0;
+    tile_cell_offsets_.clear();
+    tile_cells_.clear();
+    loaded_count_ = 0;
+    primitives_.clear();
+    primitives_dirty_ = false;
+    primitives_version_++;
+}
+
+//****************************************************************
+// apply
+Vector TiledTerrain::apply(const Vector& vv) {
+    if (!is_open()) { return vv; }
+
+    Vector v = vv;
+
+    float minx = left_ + 1.0f;
+    float miny = top_ + 1.0f;
+    float maxx = left_ + width() - 1.0f;
+    float maxy = top_ + height() - 1.0f;
+
+    if (v.x <minx) { v.x = minx; }
+    if (v.y <miny) { v.y = miny; }
+    if (maxx <= v.x) { v.x = maxx; }
+    if (maxy <= v.y) { v.y = maxy; }
+
+    Tile& t = use_tile(column_of(v.x), row_of(v.y));
+    return apply_terrain_constraint(
+        t.tmm, ArrayView<TerrainCellSite>(t.cell_sites), v);
+}
+
+//****************************************************************
+// prefetch
+void TiledTerrain::prefetch(const Vector& minp, const Vector& maxp) {
+    if (!is_open()) { return; }
+
+    footprint_clock_ = clock_ + 1;
+
+    int c0 = column_of(minp.x);
+    int c1 = column_of(maxp.x);
+    int r0 = row_of(minp.y);
+    int r1 = row_of(maxp.y);
+    for (int r = r0 ; r <= r1 ; r++) {
+        for (int c = c0 ; c <= c1 ; c++) {
+            int index = r * columns_ + c;
+            Tile& t = tiles_[index];
+            t.last_used = ++clock_;
+            if (t.loaded || t.pending.valid() ||
+                TERRAIN_MAX_PENDING_TILES <= pending_.size()) {
+                continue;
+            }
+            t.pending = std::async(
+                std::launch::async,
+                [this, index]() { compile_tile(index); });
+            pending_.push_back(index);
+        }
+    }
+
+    install_compiled();
+}
+
+//****************************************************************
+// primitives
+const std::vector<Primitive>& TiledTerrain::primitives() {
+    if (primitives_dirty_) {
+        primitives_.clear();
+        for (int i = 0 ; i < columns_ * rows_ ; i++) {
+            const Tile& t = tiles_[i];
+            if (t.loaded) {
+                primitives_.insert(
+                    primitives_.end(),
+                    t.primitives.begin(), t.primitives.end());
+            }
+        }
+        primitives_dirty_ = false;
+        primitives_version_++;
+    }
+    return primitives_;
+}
+
+//----------------------------------------------------------------
+// column_of
+int TiledTerrain::column_of(float x) const {
+    int c = int(floor((x - left_) / tile_size_));
+    return (std::max)(0, (std::min)(columns_ - 1, c));
+}
+
+//----------------------------------------------------------------
+// row_of
+int TiledTerrain::row_of(float y) const {
+    int r = int(floor((y - top_) / tile_size_));
+    return (std::max)(0, (std::min)(rows_ - 1, r));
+}
+
+//----------------------------------------------------------------
+// use_tile
+TiledTerrain::Tile& TiledTerrain::use_tile(int column, int row) {
+    int index = row * columns_ + column;
+    Tile& t = tiles_[index];
+    t.last_used = ++clock_;
+    if (t.loaded) { return t; }
+
+    // prefetchς݂Ȃ烏[J[҂AłȂ΂ŃRpC
+    if (t.pending.valid()) {
+        t.pending.get();
+        pending_.erase(std::find(pending_.begin(), pending_.end(), index));
+    } else {
+        compile_tile(index);
+    }
+    finish_tile(index);
+    evict(index);
+    return t;
+}
+
+//----------------------------------------------------------------
+// install_compiled
+void TiledTerrain::install_compiled() {
+    for (size_t i = 0 ; i < pending_.size() ; ) {
+        int index = pending_[i];
+        std::future<void>& f = tiles_[index].pending;
+        if (f.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+            i++;
+            continue;
+        }
+        f.get(); // [J[̗O͂œ
+        pending_.erase(pending_.begin() + i);
+        finish_tile(index);
+    }
+    evict(-1);
+}
+
+//----------------------------------------------------------------
+// compile_tile
+// [J[XbhĂ΂邱Ƃ
+// (doc_ƕ̏ǂ݁Atiles_[index]tmmȉ)
+void TiledTerrain::compile_tile(int index) {
+    PerformanceCounter pc(false);
+
+    Tile& t = tiles_[index];
+    const int* tile_cells = tile_cells_.empty() ? nullptr : &tile_cells_[0];
+    ArrayView<int> cells(
+        tile_cells + tile_cell_offsets_[index],
+        tile_cells + tile_cell_offsets_[index + 1]);
+
+    // TrapezoidalMap͈̔͂̓^CƃZŜ܂ޑ傫ɂ
+    int column = index % columns_;
+    int row = index / columns_;
+    Bounds b;
+    b.add(D3DXVECTOR2(left_ + column * tile_size_, top_ + row * tile_size_));
+    b.add(D3DXVECTOR2(
+              left_ + (column + 1) * tile_size_,
+              top_ + (row + 1) * tile_size_));
+
+    t.cell_sites.clear();
+    t.cell_sites.reserve(cells.size());
+    for (int cell: cells) {
+        Bounds cb = cell_bounds(doc_, cell);
+        b.add(D3DXVECTOR2(cb.minx, cb.miny));
+        b.add(D3DXVECTOR2(cb.maxx, cb.maxy));
+        t.cell_sites.push_back(make_terrain_cell_site(doc_, cell));
+    }
+
+    std::vector<TerrainSegment> segments;
+    collect_terrain_segments(doc_, cells, segments);
+    {
+        // ^C̒[ŊOgɓƂ̓Z̊O
+        TerrainSegmentProperty outside;
+        outside.upper_cell_index = -1;
+        outside.lower_cell_index = -1;
+
+        TerrainMap tm(b.minx - 1.0f, b.miny - 1.0f,
+                      b.maxx + 1.0f, b.maxy + 1.0f, outside);
+        build_terrain_map(
+            tm, segments, terrain_depth_bound(segments.size()),
+            [&tm](size_t, const TerrainSegment& ts) {
+                tm.add_segment(
+                    tm.make_point(ts.p0.x, ts.p0.y),
+                    tm.make_point(ts.p1.x, ts.p1.y),
+                    true, ts.sp);
+            });
+        t.tmm.init(tm);
+    }
+
+    // `bounding box̒S^C󂯎
+    t.primitives.clear();
+    post_color(t.primitives, 0, 0, 0);
+    for (int cell: cells) {
+        Bounds cb = cell_bounds(doc_, cell);
+        if (column_of((cb.minx + cb.maxx) * 0.5f) == column &&
+            row_of((cb.miny + cb.maxy) * 0.5f) == row) {
+            post_cell_outline(doc_, cell, t.primitives);
+        }
+    }
+    for (int cell: cells) {
+        Bounds cb = cell_bounds(doc_, cell);
+        if (column_of((cb.minx + cb.maxx) * 0.5f) == column &&
+            row_of((cb.miny + cb.maxy) * 0.5f) == row) {
+            int color_index = cell; // ^CɈ˂炸ZƂɓF
+            post_random_color(t.primitives, color_index);
+            post_cell_fill(doc_, cell, t.primitives);
+        }
+    }
+
+    dprintf("tile (%d, %d): %d cells, %d segments, %d bytes, %f sec\n",
+            column, row, int(cells.size()), int(segments.size()),
+            int(t.tmm.image_size()), pc());
+}
+
+//----------------------------------------------------------------
+// finish_tile
+void TiledTerrain::finish_tile(int index) {
+    tiles_[index].loaded = true;
+    loaded_count_++;
+    primitives_dirty_ = true;
+}
+
+//----------------------------------------------------------------
+// evict
+void TiledTerrain::evict(int keep) {
+    // keepƒOprefetch͈͈̔ȊOňԌÂ̂̂Ă
+    while (max_loaded_tiles_ < loaded_count_) {
+        int oldest = -1;
+        for (int i = 0 ; i < columns_ * rows_ ; i++) {
+            const Tile& t = tiles_[i];
+            if (i != keep && t.loaded && t.last_used < footprint_clock_ &&
+                (oldest < 0 || t.last_used < tiles_[oldest].last_used)) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0) { break; }
+        unload_tile(oldest);
+    }
+}
+
+//----------------------------------------------------------------
+// unload_tile
+void TiledTerrain::unload_tile(int index) {
+    Tile& t = tiles_[index];
+    t.tmm.clear();
+    std::vector<TerrainCellSite>().swap(t.cell_sites);
+    std::vector<Primitive>().swap(t.primitives);
+    t.loaded = false;
+    loaded_count_--;
+    primitives_dirty_ = true;
+}
+
+//>>>>>>>>>> TiledTerrain
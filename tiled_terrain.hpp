@@ -0,0 +1,131 @@
+// 2026/10/19
+
+/*!
+	@file	  tiled_terrain.hpp
+	@brief	  <Tv>
+
+	傫}bvp̃^Cn`
+	.gcbmmapĂA^CƂTrapezoidalMapMachinePrimitive
+	prefetchŃ[J[XbhɃRpC
+	(prefetchĂȂ^CɗqƂ͂̏ŃRpC)
+	ǂݍݐ𒴂ŌɎgꂽ̂Â̂̂Ă
+	(Oprefetch͈̔͂̃^C͏𒴂Ă̂ĂȂ)
+*/
+
+#ifndef TILED_TERRAIN_HPP_
+#define TILED_TERRAIN_HPP_
+
+#include <memory>
+#include <future>
+#include <vector>
+#include "terrain.hpp"
+#include "gci.hpp"
+#include "water.hpp"
+
+const float  TERRAIN_TILE_SIZE          = 512.0f;
+const size_t TERRAIN_MAX_LOADED_TILES   = 16;
+
+// Ƀ[J[ŃRpC^C̐
+const size_t TERRAIN_MAX_PENDING_TILES  = 4;
+
+// Boardq͈̔͂ꂾLprefetch
+const float  TERRAIN_PREFETCH_MARGIN    = 64.0f;
+
+class TiledTerrain : public IConstraint {
+public:
+    TiledTerrain(
+        float tile_size = TERRAIN_TILE_SIZE,
+        size_t max_loaded_tiles = TERRAIN_MAX_LOADED_TILES);
+    ~TiledTerrain() { close(); }
+
+    // Z^CɐU蕪邾ŁARpC͂Ȃ
+    bool open(const char* filename);
+    void close();
+    bool is_open() const { return doc_.is_open(); }
+
+    float left() const { return left_; }
+    float top() const { return top_; }
+    float width() const { return columns_ * tile_size_; }
+    float height() const { return rows_ * tile_size_; }
+
+    // IConstraint
+    // v̓Ă^C(ȂΓǂݍ)
+    Vector apply(const Vector& v);
+
+    // minp-maxpɂ^C[J[ŃRpCn߁A
+    // IĂ̂g悤ɂ(t[Ă)
+    // ͈̔͂̃^C͎prefetch܂ŒǂoȂ
+    void prefetch(const Vector& minp, const Vector& maxp);
+
+    // centerradiusȓ
+    void prefetch(const Vector& center, float radius) {
+        Vector r(radius, radius);
+        prefetch(center - r, center + r);
+    }
+
+    // ǂݍ܂Ă^CPrimitive
+    // ǂݍ݁EǂoƂ蒼
+    const std::vector<Primitive>& primitives();
+
+    // primitives()蒼邽тɐi
+    unsigned int primitives_version() const { return primitives_version_; }
+
+    size_t loaded_tile_count() const { return loaded_count_; }
+    size_t pending_tile_count() const { return pending_.size(); }
+
+private:
+    struct Tile {
+        Tile() : loaded(false), last_used(0) {}
+
+        bool                            loaded;
+        unsigned int                    last_used;
+        TerrainMachine                  tmm;
+        std::vector<TerrainCellSite>    cell_sites; // tmm̃Zԍň
+        std::vector<Primitive>          primitives;
+
+        // [J[compile_tile(I܂tmmȉɂ͐GȂ)
+        std::future<void>               pending;
+    };
+
+    int column_of(float x) const;
+    int row_of(float y) const;
+    Tile& use_tile(int column, int row);
+    void install_compiled();
+    void compile_tile(int index);
+    void finish_tile(int index);
+    void evict(int keep);
+    void unload_tile(int index);
+
+private:
+    gci::MappedDocument     doc_;
+
+    float                   tile_size_;
+    size_t                  max_loaded_tiles_;
+
+    float                   left_;
+    float                   top_;
+    int                     columns_;
+    int                     rows_;
+    std::unique_ptr<Tile[]> tiles_;
+
+    // ^CƂ̃Zԍ(CSR)
+    // bounding box^CSɓ
+    std::vector<int>        tile_cell_offsets_;
+    std::vector<int>        tile_cells_;
+
+    unsigned int            clock_;
+    size_t                  loaded_count_;
+
+    // Oprefetchn߂Ƃclock_
+    // last_usedȏ̃^C͒ǂoȂ
+    unsigned int            footprint_clock_;
+
+    std::vector<int>        pending_;   // pendingLȃ^C
+
+    std::vector<Primitive>  primitives_;
+    bool                    primitives_dirty_;
+    unsigned int            primitives_version_;
+
+};
+
+#endif // TILED_TERRAIN_HPP_
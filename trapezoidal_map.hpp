@@ -12,11 +12,78 @@
 
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <type_traits>
 #include <boost/lexical_cast.hpp>
+#include <boost/utility.hpp>
 #include "zw/dprintf.hpp"
 
+// PAP[^
+// ʂɂ͉AubNPʂł܂Ƃ߂Ď̂Ă
+class MonotonicArena : boost::noncopyable {
+public:
+    enum {
+        ALIGNMENT       = 16,
+        MIN_BLOCK_SIZE  = 64 * 1024,
+        MAX_BLOCK_SIZE  = 4 * 1024 * 1024,
+    };
+
+public:
+    MonotonicArena()
+        : next_block_size_(MIN_BLOCK_SIZE), curr_(NULL), rest_(0) {}
+    ~MonotonicArena() { release(); }
+
+    void* allocate(size_t n) {
+        n = (n + ALIGNMENT - 1) & ~size_t(ALIGNMENT - 1);
+        if (rest_ < n) { grow(n); }
+        void* p = curr_;
+        curr_ += n;
+        rest_ -= n;
+        return p;
+    }
+
+    void release() {
+        for (size_t i = 0 ; i < blocks_.size() ; i++) {
+            ::operator delete(blocks_[i]);
+        }
+        blocks_.clear();
+        next_block_size_ = MIN_BLOCK_SIZE;
+        curr_ = NULL;
+        rest_ = 0;
+    }
+
+    size_t block_count() const { return blocks_.size(); }
+
+private:
+    void grow(size_t n) {
+        size_t size = next_block_size_;
+        while (size < n) { size *= 2; }
+        if (next_block_size_ < MAX_BLOCK_SIZE) { next_block_size_ *= 2; }
+
+        curr_ = (char*)::operator new(size);
+        rest_ = size;
+        blocks_.push_back(curr_);
+    }
+
+private:
+    std::vector<char*>  blocks_;
+    size_t              next_block_size_;
+    char*               curr_;
+    size_t              rest_;
+
+};
+
 template <class R, class SegmentProperty>
 class TrapezoidalMap {
+    // m[hƐ̓A[iɒuăfXgN^Ă΂Ɏ̂Ă
+    static_assert(
+        std::is_trivially_destructible<SegmentProperty>::value,
+        "SegmentProperty must be trivially destructible");
+
 public:
     struct Point {
     public:
@@ -142,6 +209,7 @@ public:
         }
 
         const SegmentProperty& property() { return property_; }
+        void property(const SegmentProperty& p) { property_ = p; }
 
     private:
         int  id_;
@@ -164,7 +232,8 @@ private:
     class Node {
     public:
         Node() {
-            static int id_seed = 1;
+            // ʁX̃}bvsɍ邱Ƃ(TiledTerrain)
+            static std::atomic<int> id_seed(1);
             id_ = id_seed++;
 
             next_ = NULL;
@@ -202,6 +271,7 @@ private:
         virtual void pass1(int& addr) = 0;
         virtual void pass2(char*) = 0;
 
+        void reset_addr() { addr_ = 0; }
         bool set_addr(int n) {
             if (0 <addr_) { return false; }
             addr_ = n;
@@ -478,12 +548,17 @@ private:
             lower_opposite_left_ = NULL;
             mark_ = false;
             score_ = 0;
+            depth_ = 0;
         }
         ~Leaf() {}
 
         int  score() { return score_; }
         void score(int v) { score_ = v; }
 
+        // ̍ő[(TrapezoidalMap::raise_depthōXV)
+        int  depth() { return depth_; }
+        void depth(int v) { depth_ = v; }
+
         void calculate_trapezoid(Point& p0, Point& p1, Point& p2, Point& p3) {
             p0.x(this->leftp.x());
             p1.x(this->rightp.x());
@@ -609,8 +684,8 @@ private:
         Leaf*  lowerright;
 
         void  pass1(int& addr) {
-            set_addr(addr);
-            addr += 64 + sizeof(SegmentProperty)* 2;
+            if (!set_addr(addr)) { return; }
+            addr += LEAF_CODE_SIZE;
         }
         void pass2(char* b) {
             char* p = b + get_addr();
@@ -642,54 +717,46 @@ private:
         Leaf*  lower_opposite_left_;
         bool  mark_;
         int   score_;
+        int   depth_;
 
     };
 
 public:
-    TrapezoidalMap(
-        R bbminx, R bbminy,
-        R bbmaxx, R bbmaxy) {
-        segment_id_seed_ = 0;
-        node_chain_ = NULL;
-        segment_chain_ = NULL;
-
-        lowest_score_ = 0;
-        highest_score_ = 0;
+    enum {
+        LEAF_CODE_SIZE = 64 + sizeof(SegmentProperty)* 2,
+        JUMP_CODE_SIZE = 12, // opcode, addr, size
+    };
 
-        Point p0(bbminx, bbminy);
-        Point p1(bbmaxx, bbminy);
-        Point p2(bbminx, bbmaxy);
-        Point p3(bbmaxx, bbmaxy);
-        Segment* s0 = new_segment(p0, p1, false, false, SegmentProperty());
-        Segment* s1 = new_segment(p2, p3, false, false, SegmentProperty());
-        Leaf* leaf = new_leaf();
-        leaf->top = s0;
-        leaf->bottom = s1;
-        leaf->leftp = p2;
-        leaf->rightp = p1;
-        leaf->upperleft = NULL;
-        leaf->lowerleft = NULL;
-        leaf->upperright = NULL;
-        leaf->lowerright = NULL;
-        Glue* glue = link_node(new Glue(leaf));
+public:
+    // find(_ʒu)̒T[(ʂ锻m[h̐)
+    struct DepthStats {
+        int     max_depth;
+        float   average_depth;  // `Ƃ̍ő[̕
+        size_t  leaf_count;
+    };
 
-        tree_ = glue;
+public:
+    // bound_property͊Og̐̑
+    TrapezoidalMap(
+        R bbminx, R bbminy,
+        R bbmaxx, R bbmaxy,
+        const SegmentProperty& bound_property = SegmentProperty())
+        : bbmin_(bbminx, bbminy), bbmax_(bbmaxx, bbmaxy),
+          bound_property_(bound_property) {
+        reset();
     }
-    ~TrapezoidalMap() { {
-            Segment* p = segment_chain_;
-            while (p) {
-                Segment* q = p->next();
-                delete p;
-                p = q;
-            }
-        } {
-            Node* p = node_chain_;
-            while (p) {
-                Node* q = p->next();
-                delete p;
-                p = q;
-            }
-        }
+    ~TrapezoidalMap() {
+        // em[hPODȂ̂ŃubNƎ̂Ă邾
+        arena_.release();
+    }
+
+    // ŜĂč̏Ԃɖ߂
+    // (add_segment̖߂lׂ͂ĖɂȂ)
+    void clear() {
+        arena_.release();
+        replaced_.clear();
+        dirty_segments_.clear();
+        reset();
     }
 
     void freeze() {
@@ -701,9 +768,13 @@ public:
         return Point(x, y);
     }
 
-    void add_segment(Point p0, Point p1,
-                     bool border = true,
-                     const SegmentProperty& property = SegmentProperty()) {
+    // Og
+    const Point& bbmin() const { return bbmin_; }
+    const Point& bbmax() const { return bbmax_; }
+
+    Segment* add_segment(Point p0, Point p1,
+                         bool border = true,
+                         const SegmentProperty& property = SegmentProperty()) {
 #if 0
         dprintf("insert segment:(%f, %f)-(%f, %f)\n",
                 p0.x(), p0.y(), p1.x(), p1.y());
@@ -786,28 +857,35 @@ public:
             if (t->upperright) { t->upperright->upperleft = B ? B : C; }
             if (t->lowerright) { t->lowerright->lowerleft = B ? B : D; }
             Node* n;
-            YNode* si = link_node(new YNode(s));
-            si->connect(link_node(new Glue(C)),
-                        link_node(new Glue(D)));
+            YNode* si = new_ynode(s);
+            si->connect(new_glue(C),
+                        new_glue(D));
             n = si;
             if (B) {
-                XNode* qi = link_node(new XNode(p1));
-                qi->connect(n, link_node(new Glue(B)));
+                XNode* qi = new_xnode(p1);
+                qi->connect(n, new_glue(B));
                 n = qi;
             }
             if (A) {
-                XNode* pi = link_node(new XNode(p0));
-                pi->connect(link_node(new Glue(A)), n);
+                XNode* pi = new_xnode(p0);
+                pi->connect(new_glue(A), n);
                 n = pi;
             }
             replace(t, n);
+
+            // t -> [pi -> A] -> [qi -> B] -> si -> C, D
+            int e = t->depth();
+            if (A) { raise_depth(A, ++e); }
+            if (B) { raise_depth(B, ++e); }
+            raise_depth(C, e + 1);
+            raise_depth(D, e + 1);
             delete_leaf(t);
         } else { // 1 <v.size()
             Leaf* t = leaf;
             Leaf* u = new_leaf();
             Leaf* d = new_leaf();
-            Glue* su = link_node(new Glue(u));
-            Glue* sd = link_node(new Glue(d));
+            Glue* su = new_glue(u);
+            Glue* sd = new_glue(d);
             u->top = t->top;
             u->bottom = s;
             d->top = s;
@@ -819,9 +897,11 @@ public:
                 d->lowerleft = t->lowerleft;
                 if (t->upperleft) { t->upperleft->upperright = u; }
                 if (t->lowerleft) { t->lowerleft->lowerright = d; }
-                YNode* si = link_node(new YNode(s));
+                YNode* si = new_ynode(s);
                 si->connect(su, sd);
                 replace(t, si);
+                raise_depth(u, t->depth() + 1);
+                raise_depth(d, t->depth() + 1);
             } else {
                 Leaf* l = new_leaf();
                 l->upperleft = t->upperleft;
@@ -838,11 +918,14 @@ public:
                 d->lowerleft = l;
                 if (t->upperleft) { t->upperleft->upperright = l; }
                 if (t->lowerleft) { t->lowerleft->lowerright = l; }
-                YNode* si = link_node(new YNode(s));
+                YNode* si = new_ynode(s);
                 si->connect(su, sd);
-                XNode* qi = link_node(new XNode(p0));
-                qi->connect(link_node(new Glue(l)), si);
+                XNode* qi = new_xnode(p0);
+                qi->connect(new_glue(l), si);
                 replace(t, qi);
+                raise_depth(l, t->depth() + 1);
+                raise_depth(u, t->depth() + 2);
+                raise_depth(d, t->depth() + 2);
             }
             u->leftp = p0;
             d->leftp = p0;
@@ -863,7 +946,7 @@ public:
                     if (t->upperright) { t->upperright->upperleft = k; }
                     if (t->lowerright) { t->lowerright->lowerleft = k; }
                     d = k;
-                    sd = link_node(new Glue(d));
+                    sd = new_glue(d);
                 } else {
                     assert(v[i-1]->lowerright == t);
                     Leaf* k = new_leaf();
@@ -880,12 +963,14 @@ public:
                     if (t->upperright) { t->upperright->upperleft = k; }
                     if (t->lowerright) { t->lowerright->lowerleft = k; }
                     u = k;
-                    su = link_node(new Glue(u));
+                    su = new_glue(u);
                 }
                 if (i <int(v.size()- 1)) {
-                    YNode* si = link_node(new YNode(s));
+                    YNode* si = new_ynode(s);
                     si->connect(su, sd);
                     replace(t, si);
+                    raise_depth(u, t->depth() + 1);
+                    raise_depth(d, t->depth() + 1);
                 }
             }
             t = v.back();
@@ -898,9 +983,11 @@ public:
                 d->lowerright = t->lowerright;
                 if (t->upperright) { t->upperright->upperleft = u; }
                 if (t->lowerright) { t->lowerright->lowerleft = d; }
-                YNode* si = link_node(new YNode(s));
+                YNode* si = new_ynode(s);
                 si->connect(su, sd);
                 replace(t, si);
+                raise_depth(u, t->depth() + 1);
+                raise_depth(d, t->depth() + 1);
             } else {
                 Leaf* r = new_leaf();
                 u->upperright = r;
@@ -917,11 +1004,14 @@ public:
                 r->rightp = t->rightp;
                 if (t->upperright) { t->upperright->upperleft = r; }
                 if (t->lowerright) { t->lowerright->lowerleft = r; }
-                YNode* si = link_node(new YNode(s));
+                YNode* si = new_ynode(s);
                 si->connect(su, sd);
-                XNode* qi = link_node(new XNode(p1));
-                qi->connect(si, link_node(new Glue(r)));
+                XNode* qi = new_xnode(p1);
+                qi->connect(si, new_glue(r));
                 replace(t, qi);
+                raise_depth(r, t->depth() + 1);
+                raise_depth(u, t->depth() + 2);
+                raise_depth(d, t->depth() + 2);
             }
 
             for (size_t iii = 0 ; iii <v.size(); iii++) {
@@ -932,6 +1022,13 @@ public:
 #if 0
         check_validity();
 #endif
+        return s;
+    }
+
+    // compileɑς̂patchŔf
+    void set_property(Segment* s, const SegmentProperty& property) {
+        s->property(property);
+        dirty_segments_.push_back(s);
     }
 
     bool find(
@@ -1020,10 +1117,28 @@ public:
         }
     }
 
+    // `̐[add_segment̂тɍXVĂ̂Ő邾
+    // ut[ɂt͂łȂ̂ōő[͌Ȃ
+    DepthStats depth_stats() const {
+        DepthStats ds;
+        ds.max_depth = max_depth_;
+        ds.leaf_count = leaf_count_;
+        ds.average_depth =
+            leaf_count_ ? float(double(depth_total_) / leaf_count_) : 0.0f;
+        return ds;
+    }
+
+    // m[h̃AhXv̂̂ɂ(ȌpatchvɓĂ)
     void compile(std::vector<char>& v) const {
         assert(sizeof(boost::uint32_t) == 4);
         assert(sizeof(float) == 4);
 
+        for (Node* p = node_chain_ ; p != NULL ; p = p->next()) {
+            p->reset_addr();
+        }
+        replaced_.clear();
+        dirty_segments_.clear();
+
         int addr = 4;
         tree_->pass1(addr);
 
@@ -1033,8 +1148,121 @@ public:
         }
     }
 
+    // compileƓR[h邪Am[h̃AhXpatch҂̕ύX
+    // Ô܂(patch𓖂ĂĂR[hƔׂ錟p)
+    void compile_detached(std::vector<char>& v) const {
+        std::vector<int> addrs;
+        for (Node* p = node_chain_ ; p != NULL ; p = p->next()) {
+            addrs.push_back(p->get_addr());
+        }
+        std::vector<std::pair<int, Glue*>> replaced(replaced_);
+        std::vector<Segment*> dirty_segments(dirty_segments_);
+
+        compile(v);
+
+        size_t i = 0;
+        for (Node* p = node_chain_ ; p != NULL ; p = p->next()) {
+            p->reset_addr();
+            p->set_addr(addrs[i++]);
+        }
+        replaced_.swap(replaced);
+        dirty_segments_.swap(dirty_segments);
+    }
+
+    // compile(܂patch)ȍ~add_segment/set_propertyvɔf
+    //  uꂽẗʒuɂJUMPAV؂͖ɑ
+    //  ̃R[h̃AhX͕ςȂ
+    void patch(std::vector<char>& v) const {
+        if (v.empty()) { compile(v); return; }
+
+        int base = int(v.size());
+        int addr = base;
+        for (size_t i = 0 ; i <replaced_.size(); i++) {
+            replaced_[i].second->child()->pass1(addr);
+        }
+        v.resize(addr);
+
+        // Vm[hnode_chain_̐擪ɂ܂Ƃ܂Ă
+        for (Node* p = node_chain_ ; p != NULL ; p = p->next()) {
+            int a = p->get_addr();
+            if (0 <a && a <base) { break; }
+            if (base <= a) { p->pass2(&v[0]); }
+        }
+
+        for (size_t i = 0 ; i <replaced_.size(); i++) {
+            char* p = &v[0] + replaced_[i].first;
+            *((boost::uint32_t*)p) = 4;        p += 4;
+            *((boost::uint32_t*)p) =
+                replaced_[i].second->child()->get_addr(); p += 4;
+            *((boost::uint32_t*)p) = LEAF_CODE_SIZE;
+        }
+
+        if (!dirty_segments_.empty()) {
+            std::set<Segment*> dirty(
+                dirty_segments_.begin(), dirty_segments_.end());
+            for (Node* p = node_chain_ ; p != NULL ; p = p->next()) {
+                Leaf* leaf = p->as_leaf();
+                if (!leaf || leaf->get_addr() == 0 ||
+                    base <= leaf->get_addr()) { continue; }
+                if (dirty.count(leaf->top) || dirty.count(leaf->bottom)) {
+                    leaf->pass2(&v[0]);
+                }
+            }
+        }
+
+        replaced_.clear();
+        dirty_segments_.clear();
+    }
+
 private:
+    // Og2{̐Ƒ`1̏Ԃ
+    void reset() {
+        segment_id_seed_ = 0;
+        node_chain_ = NULL;
+        segment_chain_ = NULL;
+        free_leaves_ = NULL;
+
+        lowest_score_ = 0;
+        highest_score_ = 0;
+
+        max_depth_ = 0;
+        depth_total_ = 0;
+        leaf_count_ = 0;
+
+        Point p0(bbmin_.x(), bbmin_.y());
+        Point p1(bbmax_.x(), bbmin_.y());
+        Point p2(bbmin_.x(), bbmax_.y());
+        Point p3(bbmax_.x(), bbmax_.y());
+        Segment* s0 = new_segment(p0, p1, false, false, bound_property_);
+        Segment* s1 = new_segment(p2, p3, false, false, bound_property_);
+        Leaf* leaf = new_leaf();
+        leaf->top = s0;
+        leaf->bottom = s1;
+        leaf->leftp = p2;
+        leaf->rightp = p1;
+        leaf->upperleft = NULL;
+        leaf->lowerleft = NULL;
+        leaf->upperright = NULL;
+        leaf->lowerright = NULL;
+        Glue* glue = new_glue(leaf);
+
+        tree_ = glue;
+    }
+
+    // t̐[͐e(L锻m[h)̂[Ō܂
+    void raise_depth(Leaf* leaf, int depth) {
+        if (leaf->depth() < depth) {
+            depth_total_ += depth - leaf->depth();
+            leaf->depth(depth);
+            if (max_depth_ < depth) { max_depth_ = depth; }
+        }
+    }
+
     void replace(Leaf* t, Node* pi) {
+        if (0 <t->get_addr()) {
+            // RpCς݂̗t͌JUMPɏ
+            replaced_.push_back(std::make_pair(t->get_addr(), t->parent()));
+        }
         t->parent()->child(pi);
     }
 
@@ -1280,7 +1508,27 @@ private:
     }
 
     Leaf* new_leaf() {
-        return link_node(new Leaf);
+        void* p;
+        if (free_leaves_) {
+            p = free_leaves_;
+            free_leaves_ = static_cast<Leaf*>(free_leaves_->next());
+        } else {
+            p = arena_.allocate(sizeof(Leaf));
+        }
+        leaf_count_++;
+        return link_node(new (p) Leaf);
+    }
+
+    Glue* new_glue(Node* child) {
+        return link_node(new (arena_.allocate(sizeof(Glue))) Glue(child));
+    }
+
+    XNode* new_xnode(const Point& p) {
+        return link_node(new (arena_.allocate(sizeof(XNode))) XNode(p));
+    }
+
+    YNode* new_ynode(Segment* s) {
+        return link_node(new (arena_.allocate(sizeof(YNode))) YNode(s));
     }
 
     template <class T>
@@ -1292,16 +1540,23 @@ private:
     }
 
     void delete_leaf(Leaf* p) {
+        leaf_count_--;
+        depth_total_ -= p->depth();
+
         if (p->prev()) { p->prev()->next(p->next()); }
         if (p->next()) { p->next()->prev(p->prev()); }
         if (node_chain_ == p) { node_chain_ = p->next(); }
-        delete p;
+
+        // ėpXg(nextNƂėp)
+        p->prev(NULL);
+        p->next(free_leaves_);
+        free_leaves_ = p;
     }
 
     Segment* new_segment(const Point& p0, const Point& p1,
                          bool swapped, bool border,
                          const SegmentProperty& property) {
-        Segment* p = new Segment(
+        Segment* p = new (arena_.allocate(sizeof(Segment))) Segment(
             segment_id_seed_++, p0, p1, swapped, border, property);
         p->next(segment_chain_);
         if (segment_chain_) { segment_chain_->prev(p); }
@@ -1310,16 +1565,45 @@ private:
     }
 
 private:
+    MonotonicArena arena_;
+
+    Point           bbmin_;
+    Point           bbmax_;
+    SegmentProperty bound_property_;
+
     Node*  tree_;
     Node*  node_chain_;
     Segment* segment_chain_;
+    Leaf*  free_leaves_;
     int   segment_id_seed_;
 
+    // patch҂̕ύX(compileŎ̂Ă)
+    mutable std::vector<std::pair<int, Glue*>>  replaced_;
+    mutable std::vector<Segment*>               dirty_segments_;
+
     int   lowest_score_;
     int   highest_score_;
 
+    // depth_stats
+    int         max_depth_;
+    long long   depth_total_;
+    size_t      leaf_count_;
+
 };
 
+// TRAPEZOIDAL_MAP_STATS`TrapezoidalMapMachine::find
+// NGƂ̖Km[h𐔂(query_stats)
+// find͕XbhĂ΂̂ŁAK␔̓[JAWvatomic
+#ifdef TRAPEZOIDAL_MAP_STATS
+#define TRAPEZOIDAL_MAP_BEGIN_QUERY()   int current_visits = 0
+#define TRAPEZOIDAL_MAP_VISIT()         (current_visits++)
+#define TRAPEZOIDAL_MAP_END_QUERY()     end_query(current_visits)
+#else
+#define TRAPEZOIDAL_MAP_BEGIN_QUERY()   ((void)0)
+#define TRAPEZOIDAL_MAP_VISIT()         ((void)0)
+#define TRAPEZOIDAL_MAP_END_QUERY()     ((void)0)
+#endif
+
 template < class R, class SegmentProperty >
 class TrapezoidalMapMachine {
 public:
@@ -1327,14 +1611,194 @@ public:
     typedef typename TrapezoidalMap<R, SegmentProperty>::Segment Segment;
 
 public:
-    TrapezoidalMapMachine() {}
-    TrapezoidalMapMachine(const TrapezoidalMap<R, SegmentProperty>& tm) {
-        tm.compile(code_);
+    // NG(t܂Œ)̖Km[h
+    struct QueryStats {
+        size_t  query_count;
+        size_t  visit_count;
+        int     max_visits;
+    };
+
+    enum {
+        // build_grid̕
+        //  GRID_AUTO: t1GRID_CELLS_PER_LEAFZ(1GRID_MAX_SIZE܂)
+        //  0: ObhgȂ
+        GRID_AUTO           = -1,
+        GRID_CELLS_PER_LEAF = 4,
+        GRID_MAX_SIZE       = 256,
+    };
+
+public:
+    TrapezoidalMapMachine()
+        : image_(NULL), image_size_(0),
+          grid_request_columns_(GRID_AUTO), grid_request_rows_(GRID_AUTO),
+          grid_columns_(0), grid_rows_(0) {
+        reset_query_stats();
+    }
+    TrapezoidalMapMachine(const TrapezoidalMap<R, SegmentProperty>& tm)
+        : image_(NULL), image_size_(0),
+          grid_request_columns_(GRID_AUTO), grid_request_rows_(GRID_AUTO),
+          grid_columns_(0), grid_rows_(0) {
+        reset_query_stats();
+        init(tm);
+    }
+
+    // image_͎code_wĂ邱Ƃ̂ŕtւ
+    // (attachR[ĥ͓w)
+    TrapezoidalMapMachine(const TrapezoidalMapMachine& x)
+        : code_(x.code_), image_(x.image_), image_size_(x.image_size_),
+          query_stats_(x.query_stats_),
+          grid_request_columns_(x.grid_request_columns_),
+          grid_request_rows_(x.grid_request_rows_),
+          grid_(x.grid_), grid_columns_(x.grid_columns_),
+          grid_rows_(x.grid_rows_), grid_left_(x.grid_left_),
+          grid_top_(x.grid_top_), grid_cell_width_(x.grid_cell_width_),
+          grid_cell_height_(x.grid_cell_height_),
+          grid_inv_width_(x.grid_inv_width_),
+          grid_inv_height_(x.grid_inv_height_) {
+        if (!code_.empty()) { image_ = &code_[0]; }
+    }
+    TrapezoidalMapMachine& operator=(const TrapezoidalMapMachine& x) {
+        if (this != &x) {
+            TrapezoidalMapMachine y(x);
+            swap(y);
+        }
+        return *this;
+    }
+
+    void swap(TrapezoidalMapMachine& x) {
+        // vectorswapł͒g̈ʒuςȂ̂image_͂̂܂܎g
+        code_.swap(x.code_);
+        std::swap(image_, x.image_);
+        std::swap(image_size_, x.image_size_);
+        std::swap(query_stats_, x.query_stats_);
+        std::swap(grid_request_columns_, x.grid_request_columns_);
+        std::swap(grid_request_rows_, x.grid_request_rows_);
+        grid_.swap(x.grid_);
+        std::swap(grid_columns_, x.grid_columns_);
+        std::swap(grid_rows_, x.grid_rows_);
+        std::swap(grid_left_, x.grid_left_);
+        std::swap(grid_top_, x.grid_top_);
+        std::swap(grid_cell_width_, x.grid_cell_width_);
+        std::swap(grid_cell_height_, x.grid_cell_height_);
+        std::swap(grid_inv_width_, x.grid_inv_width_);
+        std::swap(grid_inv_height_, x.grid_inv_height_);
     }
 
     void init(const TrapezoidalMap<R, SegmentProperty>& tm) {
         code_.clear();
         tm.compile(code_);
+        image_ = code_.empty() ? NULL : &code_[0];
+        image_size_ = code_.size();
+        build_grid(grid_request_columns_, grid_request_rows_);
+    }
+
+    // init(tm)ȍ~tmւ̕ύXŔf
+    void patch(const TrapezoidalMap<R, SegmentProperty>& tm) {
+        assert(!code_.empty()); // attachR[hɂ͓ĂȂ
+        tm.patch(code_);
+        image_ = code_.empty() ? NULL : &code_[0];
+        image_size_ = code_.size();
+        build_grid(grid_request_columns_, grid_request_rows_);
+    }
+
+    // O(mmapLbVȂ)̃R[hRs[Ɏg
+    // image̎͌Ăяoۏ؂邱
+    void attach(const char* image, size_t size) {
+        code_.clear();
+        image_ = image;
+        image_size_ = size;
+        build_grid(grid_request_columns_, grid_request_rows_);
+    }
+
+    // R[ĥĂ(findOinit/attach)
+    void clear() {
+        std::vector<char>().swap(code_);
+        std::vector<boost::uint32_t>().swap(grid_);
+        image_ = NULL;
+        image_size_ = 0;
+    }
+
+    // n}͈̔͂columns x rowsɕAZƂfind̊Jnʒuo
+    // ZŜɗ锻͑Očς܂ĂA
+    // 1̑`Ɏ܂Z̗͂t𒼐ڎw
+    // w͈Ȍinit/patch/attachłg
+    // R[h`ɓǂނȂ̂attachR[hɂ
+    void build_grid(int columns = GRID_AUTO, int rows = GRID_AUTO) {
+        grid_request_columns_ = columns;
+        grid_request_rows_ = rows;
+        grid_.clear();
+        grid_columns_ = 0;
+        grid_rows_ = 0;
+        if (!image_ || image_size_ <= 4 || columns == 0 || rows == 0) {
+            return;
+        }
+        if (*((int*)(image_ + 4)) == 0) { return; }
+
+        // ͈͂̓R[hɏoĂW狁߂
+        float minx = FLT_MAX;
+        float miny = FLT_MAX;
+        float maxx = -FLT_MAX;
+        float maxy = -FLT_MAX;
+        size_t leaf_count = 0;
+        const char* b = image_;
+        const char* p = b + 4;
+        const char* e = b + image_size_;
+        while (p < e) {
+            int n = 0;
+            int size = 0;
+            switch (*((int*)p)) {
+                case 1: n = 1; size = 20; break;
+                case 2: n = 2; size = 36; break;
+                case 3: n = 4; size = LEAF_CODE_SIZE; leaf_count++; break;
+                case 4: size = *((boost::uint32_t*)(p+8)); break;
+                default: return; // Ă
+            }
+            for (int i = 0 ; i < n ; i++) {
+                // t͏(+4..)Ɖ(+28..)̒[_
+                const float* v = (const float*)(p + 4 + (i / 2) * 24) +
+                    (i % 2) * 2;
+                minx = (std::min)(minx, v[0]);
+                miny = (std::min)(miny, v[1]);
+                maxx = (std::max)(maxx, v[0]);
+                maxy = (std::max)(maxy, v[1]);
+            }
+            if (size <= 0) { return; }
+            p += size;
+        }
+        if (!(minx < maxx && miny < maxy)) { return; }
+
+        if (columns < 0 || rows < 0) {
+            // Zقڐ`ɂȂ悤ɕ
+            float cells = float(leaf_count * GRID_CELLS_PER_LEAF);
+            float aspect = (maxx - minx) / (maxy - miny);
+            columns = int(sqrtf(cells * aspect)) + 1;
+            rows = int(sqrtf(cells / aspect)) + 1;
+            columns = (std::min)(columns, int(GRID_MAX_SIZE));
+            rows = (std::min)(rows, int(GRID_MAX_SIZE));
+        }
+
+        grid_columns_ = columns;
+        grid_rows_ = rows;
+        grid_left_ = minx;
+        grid_top_ = miny;
+        grid_cell_width_ = (maxx - minx) / columns;
+        grid_cell_height_ = (maxy - miny) / rows;
+        grid_inv_width_ = 1.0f / grid_cell_width_;
+        grid_inv_height_ = 1.0f / grid_cell_height_;
+
+        grid_.resize(columns * rows);
+        fill_grid(0, 0, columns, rows, 4);
+    }
+
+    const char* image() const { return image_; }
+    size_t image_size() const { return image_size_; }
+
+    // vrhłȂΏ0
+    QueryStats query_stats() const { return query_stats_.load(); }
+    void reset_query_stats() {
+        query_stats_.query_count = 0;
+        query_stats_.visit_count = 0;
+        query_stats_.max_visits = 0;
     }
 
     bool find(
@@ -1357,17 +1821,20 @@ public:
         int& score,
         SegmentProperty& tsp,
         SegmentProperty& bsp) const {
-        const char* b = &code_[0];
-        const char* p = b + 4;
+        const char* b = image_;
+        const char* p = b + entry(q);
+        TRAPEZOIDAL_MAP_BEGIN_QUERY();
 
         switch (*((int*)p)) {
             case 0: return false;
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE1: {
+            TRAPEZOIDAL_MAP_VISIT();
             float x = *((float*)(p+4));
             float y = *((float*)(p+8));
             int offset;
@@ -1383,9 +1850,11 @@ public:
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE2: {
+            TRAPEZOIDAL_MAP_VISIT();
             float p0x = *((float*)(p+4));
             float p0y = *((float*)(p+8));
             float p1x = *((float*)(p+12));
@@ -1414,9 +1883,12 @@ public:
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE3: {
+            TRAPEZOIDAL_MAP_VISIT();
+            TRAPEZOIDAL_MAP_END_QUERY();
             float tp0x = *((float*)(p+4));
             float tp0y = *((float*)(p+8));
             float tp1x = *((float*)(p+12));
@@ -1446,6 +1918,19 @@ public:
             bsp = *((SegmentProperty*)(p+64+sizeof(SegmentProperty)));
             return true;
         }
+
+      OPCODE4: {
+            TRAPEZOIDAL_MAP_VISIT();
+            // patchŒuꂽt
+            p = b + *((boost::uint32_t*)(p+4));
+        }
+        switch (*((int*)p)) {
+            case 1: goto OPCODE1;
+            case 2: goto OPCODE2;
+            case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
+        }
+        return false;
     }
 
 
@@ -1454,8 +1939,9 @@ public:
         int& score,
         SegmentProperty& top_segment_property,
         SegmentProperty& bottom_segment_property) const {
-        const char* b = &code_[0];
-        const char* p = b + 4;
+        const char* b = image_;
+        const char* p = b + entry(q);
+        TRAPEZOIDAL_MAP_BEGIN_QUERY();
 
         // computed goto version
         switch (*((int*)p)) {
@@ -1463,9 +1949,11 @@ public:
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE1: {
+            TRAPEZOIDAL_MAP_VISIT();
             float x = *((float*)(p+4));
             float y = *((float*)(p+8));
             int offset;
@@ -1482,9 +1970,11 @@ public:
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE2: {
+            TRAPEZOIDAL_MAP_VISIT();
             float p0x = *((float*)(p+4));
             float p0y = *((float*)(p+8));
             float p1x = *((float*)(p+12));
@@ -1513,15 +2003,30 @@ public:
             case 1: goto OPCODE1;
             case 2: goto OPCODE2;
             case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
         }
 
       OPCODE3: {
+            TRAPEZOIDAL_MAP_VISIT();
+            TRAPEZOIDAL_MAP_END_QUERY();
             score = *((boost::uint32_t*)(p+60));
             top_segment_property = *((SegmentProperty*)(p+64));
             bottom_segment_property =
                 *((SegmentProperty*)(p+64+sizeof(SegmentProperty)));
             return true;
         }
+
+      OPCODE4: {
+            TRAPEZOIDAL_MAP_VISIT();
+            p = b + *((boost::uint32_t*)(p+4));
+        }
+        switch (*((int*)p)) {
+            case 1: goto OPCODE1;
+            case 2: goto OPCODE2;
+            case 3: goto OPCODE3;
+            case 4: goto OPCODE4;
+        }
+        return false;
     }
 
     float calc_y(float qx,
@@ -1563,9 +2068,9 @@ public:
         os << ind(2)<< "float sy;" << std::endl;
 
         // core code
-        const char* b = &code_[0];
+        const char* b = image_;
         const char* p = b + 4;
-        const char* e = b + code_.size();
+        const char* e = b + image_size_;
         while (p <e) {
             os << ind(1)<< " ADDR" <<(p - b)<< ":" << std::endl;
 
@@ -1646,6 +2151,12 @@ public:
 
                     p += 64 + sizeof(SegmentProperty)* 2;
                     break;
+
+                case 4:
+                    os << ind(2)<< "goto ADDR" << *((boost::uint32_t*)(p+4))
+                       << ";" << std::endl << std::endl;
+                    p += *((boost::uint32_t*)(p+8));
+                    break;
             }
         }
 
@@ -1658,8 +2169,161 @@ public:
         return std::string(4 * x, ' ');
     }
 
+private:
+    enum {
+        LEAF_CODE_SIZE = TrapezoidalMap<R, SegmentProperty>::LEAF_CODE_SIZE,
+    };
+
+    // q̓Obh̃Z̊Jnʒu(Obh̊OȂ獪)
+    boost::uint32_t entry(const Point& q) const {
+        if (grid_.empty()) { return 4; }
+        float fx = (q.x() - grid_left_) * grid_inv_width_;
+        float fy = (q.y() - grid_top_) * grid_inv_height_;
+        if (!(0 <= fx && fx < grid_columns_ && 0 <= fy && fy < grid_rows_)) {
+            return 4;
+        }
+        return grid_[int(fy) * grid_columns_ + int(fx)];
+    }
+
+    // Z̋`[c0, c1) x [r0, r1)̑S_}ɐiފԂ
+    // start~AɊĎq̋`͂瑱
+    void fill_grid(int c0, int r0, int c1, int r1, boost::uint32_t start) {
+        boost::uint32_t entry = descend_grid(c0, r0, c1, r1, start);
+        if (c1 - c0 == 1 && r1 - r0 == 1) {
+            grid_[r0 * grid_columns_ + c0] = entry;
+            return;
+        }
+        if (*((int*)(image_ + entry)) == 3) {
+            // 1̑`Ɏ܂
+            for (int r = r0 ; r < r1 ; r++) {
+                for (int c = c0 ; c < c1 ; c++) {
+                    grid_[r * grid_columns_ + c] = entry;
+                }
+            }
+            return;
+        }
+        if (r1 - r0 < c1 - c0) {
+            int cm = (c0 + c1) / 2;
+            fill_grid(c0, r0, cm, r1, entry);
+            fill_grid(cm, r0, c1, r1, entry);
+        } else {
+            int rm = (r0 + r1) / 2;
+            fill_grid(c0, r0, c1, rm, entry);
+            fill_grid(c0, rm, c1, r1, entry);
+        }
+    }
+
+    // entrẙۂ߂ŃZ͂ݏo_ĂʂɂȂ悤
+    // `͏LĔ肷
+    boost::uint32_t descend_grid(
+        int c0, int r0, int c1, int r1, boost::uint32_t start) const {
+        float mx = grid_cell_width_ * (1.0f / 64);
+        float my = grid_cell_height_ * (1.0f / 64);
+        float x0 = grid_left_ + grid_cell_width_ * c0 - mx;
+        float x1 = grid_left_ + grid_cell_width_ * c1 + mx;
+        float y0 = grid_top_ + grid_cell_height_ * r0 - my;
+        float y1 = grid_top_ + grid_cell_height_ * r1 + my;
+
+        const char* b = image_;
+        const char* p = b + start;
+        for (;;) {
+            boost::uint32_t offset = 0;
+            switch (*((int*)p)) {
+                case 1: {
+                    float x = *((float*)(p+4));
+                    if (x1 < x) {
+                        offset = *((boost::uint32_t*)(p+12));
+                    } else if (x < x0) {
+                        offset = *((boost::uint32_t*)(p+16));
+                    }
+                    break;
+                }
+                case 2: {
+                    float p0x = *((float*)(p+4));
+                    float p0y = *((float*)(p+8));
+                    float p1x = *((float*)(p+12));
+                    float p1y = *((float*)(p+16));
+                    float la = *((float*)(p+20));
+                    float lb = *((float*)(p+24));
+                    float xa = (std::max)(x0, p0x);
+                    float xb = (std::min)(x1, p1x);
+                    if (p0x == p1x || xb < xa) { break; }
+
+                    // calc_ẙۂߌ덷̕L
+                    float ya = calc_y(xa, p0x, p0y, p1x, p1y, la, lb);
+                    float yb = calc_y(xb, p0x, p0y, p1x, p1y, la, lb);
+                    float err = 4 * FLT_EPSILON * (
+                        fabs(la) * (std::max)(fabs(xa), fabs(xb)) +
+                        fabs(lb) + (std::max)(fabs(p0y), fabs(p1y)));
+                    if (y1 < (std::min)(ya, yb) - err) {
+                        offset = *((boost::uint32_t*)(p+28));
+                    } else if ((std::max)(ya, yb) + err < y0) {
+                        offset = *((boost::uint32_t*)(p+32));
+                    }
+                    break;
+                }
+                case 4:
+                    offset = *((boost::uint32_t*)(p+4));
+                    break;
+                default:
+                    break;
+            }
+            if (offset == 0) { return boost::uint32_t(p - b); }
+            p = b + offset;
+        }
+    }
+
+    void end_query(int visits) const {
+        query_stats_.query_count++;
+        query_stats_.visit_count += visits;
+        int m = query_stats_.max_visits;
+        while (m < visits &&
+               !query_stats_.max_visits.compare_exchange_weak(m, visits)) {
+        }
+    }
+
+    // QueryStatsatomic(Rs[͒l)
+    struct AtomicQueryStats {
+        std::atomic<size_t> query_count;
+        std::atomic<size_t> visit_count;
+        std::atomic<int>    max_visits;
+
+        AtomicQueryStats() : query_count(0), visit_count(0), max_visits(0) {}
+        AtomicQueryStats(const AtomicQueryStats& x) { *this = x; }
+        AtomicQueryStats& operator=(const AtomicQueryStats& x) {
+            query_count = size_t(x.query_count);
+            visit_count = size_t(x.visit_count);
+            max_visits = int(x.max_visits);
+            return *this;
+        }
+        QueryStats load() const {
+            QueryStats s;
+            s.query_count = query_count;
+            s.visit_count = visit_count;
+            s.max_visits = max_visits;
+            return s;
+        }
+    };
+
 private:
     std::vector<char>  code_;
+    const char*        image_;
+    size_t             image_size_;
+
+    mutable AtomicQueryStats    query_stats_;
+
+    // build_grid
+    int                             grid_request_columns_;
+    int                             grid_request_rows_;
+    std::vector<boost::uint32_t>    grid_;
+    int                             grid_columns_;
+    int                             grid_rows_;
+    float                           grid_left_;
+    float                           grid_top_;
+    float                           grid_cell_width_;
+    float                           grid_cell_height_;
+    float                           grid_inv_width_;
+    float                           grid_inv_height_;
 
 };
 
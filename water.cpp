@@ -3,16 +3,126 @@
 #include "water.hpp"
 #include "zw/dprintf.hpp"
 #include "performance_counter.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <future>
+#include <thread>
 
 const float DISPLAY_MAG			   = 1.0f;
 const float DOT_SIZE			   = 9.0f;
 
-namespace {
+/*============================================================================
+ *
+ * class LodPartawn
+ *
+ * ܂Ƃ߂qload
+ * 擪̃o[̈ʒuɒuAق̃o[͂̑ΈʒuŎ
+ * ʒuWater::stepŏ邽тɑSo[֒S+offsetŏʂ
+ *
+ *==========================================================================*/
+class LodPartawn : public IPartawn {
+public:
+    struct Member {
+        IPartawn*   partawn;
+        Vector      offset;
+        float       mass;
+    };
+
+    LodPartawn() : index(0), count(0), split(false), dirty(false) {}
+
+    LodPartawn* as_lod() { return this; }
+
+    // x̐͐擪̃o[ɔC
+    Vector constraint_velocity(const Vector& v) {
+        return members[0].partawn->constraint_velocity(v);
+    }
+
+    // eo[̈ʒuōsʂŕς
+    Vector move(const Vector& p) {
+        Vector v(0, 0);
+        float mass = 0;
+        for (int i = 0 ; i < count ; i++) {
+            const Member& m = members[i];
+            v += m.partawn->move(p + m.offset) * m.mass;
+            mass += m.mass;
+        }
+        return 0 < mass ? v / mass : v;
+    }
+
+    Vector location() {
+        return members[0].partawn->location() - members[0].offset;
+    }
+    void location(const Vector& p) {
+        for (int i = 0 ; i < count ; i++) {
+            members[i].partawn->location(p + members[i].offset);
+        }
+    }
+
+    // NĂΐĂ
+    float life() {
+        float x = -1.0f;
+        for (int i = 0 ; i < count ; i++) {
+            x = (std::max)(x, members[i].partawn->life());
+        }
+        return x;
+    }
+    TeamTag team_tag() { return members[0].partawn->team_tag(); }
+
+    void preattack() {
+        for (int i = 0 ; i < count ; i++) { members[i].partawn->preattack(); }
+    }
+    void attack(float elapsed, IPartawn* target) {
+        for (int i = 0 ; i < count ; i++) {
+            members[i].partawn->attack(elapsed, target);
+        }
+    }
+    void suffer_damage(float damage) {
+        for (int i = 0 ; i < count ; i++) {
+            members[i].partawn->suffer_damage(damage / count);
+        }
+    }
+
+    // o[TeamXV
+    void update(float) {}
+
+    // 񂾃o[O(Ԃ)
+    int remove_dead() {
+        int n = 0;
+        for (int i = 0 ; i < count ; i++) {
+            if (members[i].partawn->life() < 0.0f) { continue; }
+            members[n++] = members[i];
+        }
+        int removed = count - n;
+        count = n;
+        if (0 < removed) { dirty = true; }
+        return removed;
+    }
 
-class Renderer {
 public:
-    typedef zw::fvf::vertex<D3DFVF_XYZRHW|D3DFVF_DIFFUSE> vertex_type;
+    Member  members[LOD_MAX_MEMBERS];
+    int     index;  // Water::lod_pool_ł̈ʒu
+    int     count;
+    bool    split;  // update_lod̍Ɨp
+    bool    dirty;  // o[(ʂĂȂ)
+    Vector  center; // update_lod̍Ɨp
+
+};
 
+namespace {
+
+typedef zw::fvf::vertex<D3DFVF_XYZRHW|D3DFVF_DIFFUSE> vertex_type;
+
+// 1DrawPrimitiveUPŕ`ő吔(ÂfoCXMaxPrimitiveCount)
+const int MAX_PRIMITIVE_COUNT = 65535;
+
+// 菭Ȃq̓XbhɕȂ
+const size_t PARALLEL_RENDER_GRAIN = 8192;
+
+// qVERTICES̒_
+// 6ȂOp`2A1Ȃ|CgXvCg
+template <int VERTICES>
+class Renderer {
 public:
     Renderer(vertex_type* v) : vertices(v) {
     }
@@ -23,13 +133,7 @@ public:
     }
 
     void operator()(
-        int     id,
         const D3DXVECTOR2& pos,
-        float    mass,
-        float    density_plain,
-        float    density_balance_corrected,
-        float    density_repulsive_corrected,
-        float    boundariness,
         const WaterTraits::load_type& load) {
 
         DWORD c = 0;
@@ -42,26 +146,28 @@ public:
                 break;
         }
 
-        Vector sx(DOT_SIZE, 0);
-        Vector sy(0, DOT_SIZE);
-        Vector sxy(DOT_SIZE, DOT_SIZE);
-        Vector pos2 = pos - sxy * 0.5f;
-
-        vertices[0].p = v4(offmag(pos2));
-        vertices[1].p = v4(offmag(pos2)+ sx);
-        vertices[2].p = v4(offmag(pos2)+ sy);
-        vertices[3].p = v4(offmag(pos2)+ sy);
-        vertices[4].p = v4(offmag(pos2)+ sx);
-        vertices[5].p = v4(offmag(pos2)+ sxy);
-
-        for (int j = 0 ; j <6 ; j++) {
-            vertices[j].c = c;
+        if (VERTICES == 1) {
+            vertices[0].p = v4(offmag(pos));
+            vertices[0].c = c;
+        } else {
+            Vector sx(DOT_SIZE, 0);
+            Vector sy(0, DOT_SIZE);
+            Vector sxy(DOT_SIZE, DOT_SIZE);
+            Vector pos2 = pos - sxy * 0.5f;
+
+            vertices[0].p = v4(offmag(pos2));
+            vertices[1].p = v4(offmag(pos2)+ sx);
+            vertices[2].p = v4(offmag(pos2)+ sy);
+            vertices[3].p = v4(offmag(pos2)+ sy);
+            vertices[4].p = v4(offmag(pos2)+ sx);
+            vertices[5].p = v4(offmag(pos2)+ sxy);
+
+            for (int j = 0 ; j <6 ; j++) {
+                vertices[j].c = c;
+            }
         }
 
-        vertices += 6;
-    }
-
-    void render_frame() {
+        vertices += VERTICES;
     }
 
     D3DXVECTOR4 v4(const Vector& v) {
@@ -69,30 +175,98 @@ public:
     }
 };
 
-struct RendererWrapper {
-    RendererWrapper(Renderer& ar) : r(ar) {}
-    Renderer& r;
+// [0, n)𕪂f(begin, end)XbhŕׂČĂ
+// threads0Ȃhardware_concurrency
+template <class F>
+void parallel_range(size_t n, F f, size_t threads = 0) {
+    if (threads == 0) {
+        threads = (std::max)(1u, std::thread::hardware_concurrency());
+    }
+    threads = (std::min)(threads, n / PARALLEL_RENDER_GRAIN);
+    if (threads <= 1) {
+        f(size_t(0), n);
+        return;
+    }
 
-    void operator()(
-        int     id,
-        const Vector& pos,
-        float    mass,
-        float    density_plain,
-        float    density_balance_corrected,
-        float    density_repulsive_corrected,
-        float    boundariness,
-        const WaterTraits::load_type& load) {
-        r(
-            id,
-            pos,
-            mass,
-            density_plain,
-            density_balance_corrected,
-            density_repulsive_corrected,
-            boundariness,
-            load);
+    std::vector<std::future<void>> futures;
+    size_t chunk = (n + threads - 1) / threads;
+    for (size_t begin = chunk ; begin < n ; begin += chunk) {
+        futures.push_back(
+            std::async(
+                std::launch::async, f, begin, (std::min)(begin + chunk, n)));
     }
-};
+    f(size_t(0), chunk);
+    for (std::future<void>& future: futures) { future.get(); }
+}
+
+template <int VERTICES, class SPH>
+void make_vertices(
+    SPH& sph, std::vector<vertex_type>& vertices, size_t threads = 0) {
+    size_t n = sph.particle_count();
+    vertices.resize(n * VERTICES);
+    if (n == 0) { return; }
+
+    auto positions = sph.positions();
+    auto loads = sph.loads();
+    float scale = sph.position_scale();
+
+    vertex_type* v = &vertices[0];
+    parallel_range(
+        n,
+        [&positions, &loads, scale, v](size_t begin, size_t end) {
+            Renderer<VERTICES> r(v + begin * VERTICES);
+            for (size_t i = begin ; i < end ; i++) {
+                r(positions[i] * scale, loads[i]);
+            }
+        },
+        threads);
+}
+
+template <int VERTICES, class SPH>
+bool check_vertices(SPH& sph) {
+    std::vector<vertex_type> serial;
+    make_vertices<VERTICES>(sph, serial, 1);
+
+    std::vector<vertex_type> split;
+    for (size_t threads = 2 ; threads <= 8 ; threads++) {
+        make_vertices<VERTICES>(sph, split, threads);
+        if (split.size() != serial.size()) { return false; }
+        for (size_t i = 0 ; i < split.size() ; i++) {
+            const vertex_type& a = serial[i];
+            const vertex_type& b = split[i];
+            if (a.p.x != b.p.x || a.p.y != b.p.y ||
+                a.p.z != b.p.z || a.p.w != b.p.w || a.c != b.c) {
+                dprintf("water vertices: %d threads differ at %d\n",
+                        int(threads), int(i));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// ܂Ƃ߂q̐擪ȊÕo[(extra)ɑ
+template <int VERTICES, class SPH, class F>
+void append_lod_vertices(
+    SPH& sph, F as_lod, size_t extra, std::vector<vertex_type>& vertices) {
+    if (extra == 0) { return; }
+    size_t base = vertices.size();
+    vertices.resize(base + extra * VERTICES);
+
+    auto positions = sph.positions();
+    auto loads = sph.loads();
+    float scale = sph.position_scale();
+
+    Renderer<VERTICES> r(&vertices[base]);
+    for (size_t i = 0 ; i < sph.particle_count() ; i++) {
+        LodPartawn* g = as_lod(loads[i]);
+        if (!g) { continue; }
+        Vector c = positions[i] * scale;
+        for (int j = 1 ; j < g->count ; j++) {
+            r(c + g->members[j].offset, g->members[j].partawn);
+        }
+    }
+}
 
 }
 
@@ -110,6 +284,14 @@ struct RendererWrapper {
 // constructor
 Water::Water() {
     constraint_ = NULL;
+    render_mode_ = RENDER_QUADS;
+    step_mode_ = STEP_FIXED;
+    pending_frames_ = 0;
+    step_count_ = 0;
+    step_dt_ = 0;
+    lod_ = false;
+    lod_clock_ = 0;
+    merged_count_ = 0;
 
     sph_.initialize(
         SEARCH_RADIUS,
@@ -119,6 +301,18 @@ Water::Water() {
         IDEAL_DENSITY,
         PRESSURE_BALANCE_COEFFICIENT,
         PRESSURE_REPULSIVE_COEFFICIENT);
+
+    // `͈ʒuloadȂ
+    sph_.set_outputs(0);
+
+    // multi-rate͊ł͎gȂ('m'Ő؂ւ)
+
+    sph_.set_pbf_parameters(PBF_REST_DENSITY, PBF_ITERATIONS, PBF_RELAXATION);
+}
+
+//****************************************************************
+// destructor
+Water::~Water() {
 }
 
 //****************************************************************
@@ -127,15 +321,38 @@ void Water::add(const Vector& v, float mass, IPartawn* partawn) {
     sph_.add_particle(v, mass, partawn);
 }
 
+//****************************************************************
+// add_static
+void Water::add_static(const Vector& v, float mass, IPartawn* partawn) {
+    Vector p = constraint_ ? constraint_->apply(v) : v;
+    sph_.add_static_particle(p, mass, partawn);
+}
+
 //****************************************************************
 // render
 void Water::render(LPDIRECT3DDEVICE9 device) {
-    typedef Renderer::vertex_type vertex_type;
-
-    static vertex_type vertices[32768];
-
-    Renderer r(vertices);
-    sph_.foreach(RendererWrapper(r));
+    int vertices_per_primitive;
+    D3DPRIMITIVETYPE type;
+    // ܂Ƃ߂q͐擪̃o[qƂĕ`
+    size_t extra = 0;
+    if (lod_pool_) {
+        assert(lod_free_.size() <= size_t(LOD_MAX_GROUPS));
+        size_t groups = LOD_MAX_GROUPS - lod_free_.size();
+        assert(groups <= merged_count_);
+        extra = merged_count_ - groups;
+    }
+    auto lod = [this](IPartawn* load) { return as_lod(load); };
+    if (render_mode_ == RENDER_POINT_SPRITES) {
+        make_vertices<1>(sph_, vertices_);
+        append_lod_vertices<1>(sph_, lod, extra, vertices_);
+        type = D3DPT_POINTLIST;
+        vertices_per_primitive = 1;
+    } else {
+        make_vertices<6>(sph_, vertices_);
+        append_lod_vertices<6>(sph_, lod, extra, vertices_);
+        type = D3DPT_TRIANGLELIST;
+        vertices_per_primitive = 3;
+    }
 
     device->SetRenderState(D3DRS_LIGHTING, FALSE);
     device->SetRenderState(D3DRS_ZENABLE, D3DZB_TRUE);
@@ -149,18 +366,94 @@ void Water::render(LPDIRECT3DDEVICE9 device) {
     device->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_DIFFUSE);
     device->SetFVF(vertex_type::format);
 
-    device->DrawPrimitiveUP(
-        D3DPT_TRIANGLELIST,
-        (r.vertices - vertices)/ 3,
-        vertices,
-        sizeof(vertex_type));
+    if (render_mode_ == RENDER_POINT_SPRITES) {
+        // q̒SDOT_SIZEsNZl(RENDER_QUADSƓ͈)
+        float size = DOT_SIZE * DISPLAY_MAG;
+        device->SetRenderState(D3DRS_POINTSPRITEENABLE, TRUE);
+        device->SetRenderState(D3DRS_POINTSCALEENABLE, FALSE);
+        device->SetRenderState(D3DRS_POINTSIZE, *(DWORD*)&size);
+    }
+
+    int count = int(vertices_.size()) / vertices_per_primitive;
+    for (int i = 0 ; i < count ; i += MAX_PRIMITIVE_COUNT) {
+        device->DrawPrimitiveUP(
+            type,
+            (std::min)(count - i, MAX_PRIMITIVE_COUNT),
+            &vertices_[i * vertices_per_primitive],
+            sizeof(vertex_type));
+    }
+
+    if (render_mode_ == RENDER_POINT_SPRITES) {
+        device->SetRenderState(D3DRS_POINTSPRITEENABLE, FALSE);
+    }
 }
 
 //****************************************************************
 // update
 void Water::update() {
+    advance();
+    discard_dead();
+
+    if (lod_ && ++lod_clock_ % LOD_INTERVAL == 0) {
+        update_lod();
+    }
+}
+
+//****************************************************************
+// set_lod
+void Water::set_lod(bool enable) {
+    if (enable && !lod_pool_) {
+        lod_pool_.reset(new LodPartawn[LOD_MAX_GROUPS]);
+        for (int i = LOD_MAX_GROUPS - 1 ; 0 <= i ; i--) {
+            lod_pool_[i].index = i;
+            lod_free_.push_back(i);
+        }
+    }
+    if (!enable && lod_) {
+        split_lod(true);
+    }
+    lod_ = enable;
+}
+
+//----------------------------------------------------------------
+// advance
+void Water::advance() {
+    if (step_mode_ == STEP_FIXED) {
+        step(DT);
+        step_count_ = 1;
+        step_dt_ = DT;
+        return;
+    }
+
+    // ÕXebv̍ő呬xCFL_FACTORdt
+    float speed = sph_.get_max_speed();
+    float cfl_dt = 0 < speed ? CFL_FACTOR / speed : FLT_MAX;
+
+    // 1t[҂cfl_dt𒴂Ȃ痭܂i߂
+    pending_frames_++;
+    if (pending_frames_ < MAX_FRAMES_PER_STEP &&
+        DT * (pending_frames_ + 1) <= cfl_dt) {
+        step_count_ = 0;
+        return;
+    }
+
+    float total = DT * pending_frames_;
+    int n = 1;
+    while (n < MAX_SUBSTEPS && cfl_dt * n < total) { n++; }
+
+    step_count_ = n;
+    step_dt_ = total / n;
+    for (int i = 0 ; i < n ; i++) {
+        step(step_dt_);
+    }
+    pending_frames_ = 0;
+}
+
+//----------------------------------------------------------------
+// step
+void Water::step(float dt) {
     //PerformanceCounter pc(true);
-    sph_.update(0.01f);
+    sph_.update(dt);
     //pc.print("update");
 
     if (constraint_) {
@@ -168,6 +461,17 @@ void Water::update() {
             [this](const Vector& v){return constraint_->apply(v);});
         //pc.print("constraint");
     }
+
+    // Team::in_teritoryȂǂlocation()ō̈ʒu悤
+    {
+        auto positions = sph_.positions();
+        auto loads = sph_.loads();
+        float scale = sph_.position_scale();
+        for (size_t i = sph_.static_particle_count() ;
+             i < sph_.particle_count() ; i++) {
+            loads[i]->location(positions[i] * scale);
+        }
+    }
  
     sph_.foreach_pair(
         [](IPartawn* car, IPartawn* cdr, float distance) {
@@ -178,10 +482,10 @@ void Water::update() {
         });
 
     sph_.foreach_pair(
-        [](IPartawn* car, IPartawn* cdr, float distance) {
+        [dt](IPartawn* car, IPartawn* cdr, float distance) {
             if (car->team_tag() != cdr->team_tag()) {
-                car->attack(0.01f, cdr);
-                cdr->attack(0.01f, car);
+                car->attack(dt, cdr);
+                cdr->attack(dt, car);
             }
         });
 
@@ -191,6 +495,266 @@ void Water::update() {
         });
 }
 
+//----------------------------------------------------------------
+// discard_dead
+// partawn͂̂Team::cleanupŏ̂
+// STEP_ADAPTIVEŐi߂Ȃt[łOĂ
+void Water::discard_dead() {
+    if (lod_pool_) {
+        for (int i = 0 ; i < LOD_MAX_GROUPS ; i++) {
+            LodPartawn& g = lod_pool_[i];
+            if (0 < g.count) { merged_count_ -= g.remove_dead(); }
+        }
+    }
+
+    sph_.discard(
+        [](IPartawn* load) {
+            return load->life() < 0.0f;
+        });
+
+    // o[S񂾂͍̗̂qƈꏏɎ̂Ă
+    if (lod_pool_) {
+        for (int i = 0 ; i < LOD_MAX_GROUPS ; i++) {
+            LodPartawn& g = lod_pool_[i];
+            if (g.dirty && g.count == 0) { free_lod(&g); }
+        }
+    }
+}
+
+//----------------------------------------------------------------
+// as_lod
+// load܂Ƃ߂qȂLodPartawn
+LodPartawn* Water::as_lod(IPartawn* load) {
+    if (!lod_pool_) { return nullptr; }
+    return load->as_lod();
+}
+
+//----------------------------------------------------------------
+// enemy_near
+bool Water::enemy_near(const Vector& v, TeamTag team_tag) {
+    int cx = int(floor(v.x / LOD_ENEMY_DISTANCE));
+    int cy = int(floor(v.y / LOD_ENEMY_DISTANCE));
+    unsigned int own = 1u << int(team_tag);
+    for (int y = cy - 1 ; y <= cy + 1 ; y++) {
+        for (int x = cx - 1 ; x <= cx + 1 ; x++) {
+            auto i = lod_teams_.find(
+                (boost::uint64_t(boost::uint32_t(x)) << 32) |
+                boost::uint32_t(y));
+            if (i != lod_teams_.end() && (i->second & ~own)) { return true; }
+        }
+    }
+    return false;
+}
+
+//----------------------------------------------------------------
+// update_lod
+void Water::update_lod() {
+    // multi-rate؂ĂƐÂȗqȂ
+    if (sph_.get_max_time_level() == 0) {
+        split_lod(true);
+        return;
+    }
+
+    // `[Ƃɂǂ̃Zɂ邩
+    lod_teams_.clear();
+    auto positions = sph_.positions();
+    auto loads = sph_.loads();
+    float scale = sph_.position_scale();
+    for (size_t i = 0 ; i < sph_.particle_count() ; i++) {
+        Vector v = positions[i] * scale;
+        int cx = int(floor(v.x / LOD_ENEMY_DISTANCE));
+        int cy = int(floor(v.y / LOD_ENEMY_DISTANCE));
+        lod_teams_[
+            (boost::uint64_t(boost::uint32_t(cx)) << 32) |
+            boost::uint32_t(cy)] |= 1u << int(loads[i]->team_tag());
+    }
+
+    split_lod(false);
+    merge_lod();
+}
+
+//----------------------------------------------------------------
+// split_lod
+// G߂EoEo[̗̂qɖ߂
+void Water::split_lod(bool all) {
+    if (!lod_pool_) { return; }
+
+    auto positions = sph_.positions();
+    auto loads = sph_.loads();
+    auto levels = sph_.time_levels();
+    float scale = sph_.position_scale();
+    int max_level = sph_.get_max_time_level();
+
+    bool any = false;
+    for (size_t i = sph_.static_particle_count() ;
+         i < sph_.particle_count() ; i++) {
+        LodPartawn* g = as_lod(loads[i]);
+        if (!g) { continue; }
+        g->center = positions[i] * scale;
+        g->split =
+            all || g->dirty || levels[i] < max_level ||
+            enemy_near(g->center, g->team_tag());
+        any = any || g->split;
+    }
+    if (!any) { return; }
+
+    sph_.discard(
+        [this](IPartawn* load) {
+            LodPartawn* g = as_lod(load);
+            return g && g->split;
+        });
+
+    for (int i = 0 ; i < LOD_MAX_GROUPS ; i++) {
+        LodPartawn& g = lod_pool_[i];
+        if (!g.split) { continue; }
+        for (int j = 0 ; j < g.count ; j++) {
+            const LodPartawn::Member& m = g.members[j];
+            Vector v = g.center + m.offset;
+            if (constraint_) { v = constraint_->apply(v); }
+            sph_.add_particle(v, m.mass, m.partawn);
+        }
+        merged_count_ -= g.count;
+        free_lod(&g);
+    }
+}
+
+//----------------------------------------------------------------
+// merge_lod
+// ÂœG̉q`[EZƂɂ܂Ƃ߂
+// ܂ĂȂ܂Ƃ߂qZ̗qƋlߒ
+void Water::merge_lod() {
+    auto positions = sph_.positions();
+    auto loads = sph_.loads();
+    auto masses = sph_.masses();
+    auto levels = sph_.time_levels();
+    float scale = sph_.position_scale();
+    int max_level = sph_.get_max_time_level();
+
+    struct Candidate {
+        int team;
+        int cx;
+        int cy;
+        int index;
+
+        bool operator<(const Candidate& c) const {
+            if (team != c.team) { return team < c.team; }
+            if (cx != c.cx) { return cx < c.cx; }
+            if (cy != c.cy) { return cy < c.cy; }
+            return index < c.index;
+        }
+    };
+    std::vector<Candidate> candidates;
+    for (size_t i = sph_.static_particle_count() ;
+         i < sph_.particle_count() ; i++) {
+        IPartawn* load = loads[i];
+        if (levels[i] < max_level) { continue; }
+        LodPartawn* g = as_lod(load);
+        if (g && LOD_MAX_MEMBERS <= g->count) { continue; }
+        Vector v = positions[i] * scale;
+        if (enemy_near(v, load->team_tag())) { continue; }
+
+        Candidate c;
+        c.team = int(load->team_tag());
+        c.cx = int(floor(v.x / LOD_MERGE_SIZE));
+        c.cy = int(floor(v.y / LOD_MERGE_SIZE));
+        c.index = int(i);
+        candidates.push_back(c);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    // offset͐Έʒu
+    std::vector<IPartawn*> removed;
+    std::vector<LodPartawn::Member> members;
+    std::vector<LodPartawn::Member> singles;
+    std::vector<LodPartawn*> groups;
+    size_t begin = 0;
+    while (begin < candidates.size()) {
+        const Candidate& c0 = candidates[begin];
+        size_t end = begin + 1;
+        while (end < candidates.size() &&
+               candidates[end].team == c0.team &&
+               candidates[end].cx == c0.cx &&
+               candidates[end].cy == c0.cy) {
+            end++;
+        }
+        if (end - begin < 2) { begin = end; continue; }
+
+        // Z̃o[S΂炷
+        members.clear();
+        for (size_t i = begin ; i < end ; i++) {
+            int k = candidates[i].index;
+            Vector v = positions[k] * scale;
+            if (LodPartawn* g = as_lod(loads[k])) {
+                for (int j = 0 ; j < g->count ; j++) {
+                    LodPartawn::Member m = g->members[j];
+                    m.offset += v;
+                    members.push_back(m);
+                }
+                merged_count_ -= g->count;
+                free_lod(g);
+            } else {
+                LodPartawn::Member m;
+                m.partawn = loads[k];
+                m.offset = v;
+                m.mass = masses[k];
+                members.push_back(m);
+            }
+            removed.push_back(loads[k]);
+        }
+
+        // LOD_MAX_MEMBERSlߒ(]1ƃv[s͂̂܂)
+        size_t j = 0;
+        while (j < members.size()) {
+            size_t n = (std::min)(
+                members.size() - j, size_t(LOD_MAX_MEMBERS));
+            if (n < 2 || lod_free_.empty()) {
+                singles.insert(
+                    singles.end(), members.begin() + j, members.end());
+                break;
+            }
+
+            LodPartawn* g = &lod_pool_[lod_free_.back()];
+            lod_free_.pop_back();
+            g->center = members[j].offset;
+            for (size_t k = 0 ; k < n ; k++) {
+                g->members[k] = members[j + k];
+                g->members[k].offset -= g->center;
+            }
+            g->count = int(n);
+            groups.push_back(g);
+            j += n;
+        }
+        begin = end;
+    }
+    if (removed.empty()) { return; }
+
+    // LodPartawng񂵂ĂĂload̃AhXŏ΂悢
+    std::sort(removed.begin(), removed.end());
+    sph_.discard(
+        [&removed](IPartawn* load) {
+            return std::binary_search(removed.begin(), removed.end(), load);
+        });
+
+    for (LodPartawn* g: groups) {
+        float mass = 0;
+        for (int j = 0 ; j < g->count ; j++) { mass += g->members[j].mass; }
+        sph_.add_particle(g->center, mass, g);
+        merged_count_ += g->count;
+    }
+    for (const LodPartawn::Member& m: singles) {
+        sph_.add_particle(m.offset, m.mass, m.partawn);
+    }
+}
+
+//----------------------------------------------------------------
+// free_lod
+void Water::free_lod(LodPartawn* g) {
+    g->count = 0;
+    g->split = false;
+    g->dirty = false;
+    lod_free_.push_back(g->index);
+}
+
 //****************************************************************
 // set_viscosity
 void Water::set_viscosity(float v) {
@@ -234,5 +798,61 @@ void Water::set_constraint(IConstraint* constraint) {
     constraint_ = constraint;
 }
 
+//****************************************************************
+// get_bounds
+bool Water::get_bounds(Vector& minp, Vector& maxp) {
+    if (sph_.particle_count() == 0) { return false; }
+
+    minp = Vector(FLT_MAX, FLT_MAX);
+    maxp = Vector(-FLT_MAX, -FLT_MAX);
+    for (const Vector& p: sph_.positions()) {
+        minp.x = (std::min)(minp.x, p.x);
+        minp.y = (std::min)(minp.y, p.y);
+        maxp.x = (std::max)(maxp.x, p.x);
+        maxp.y = (std::max)(maxp.y, p.y);
+    }
+    float scale = sph_.position_scale();
+    minp *= scale;
+    maxp *= scale;
+    return true;
+}
+
 //>>>>>>>>>> Water
 
+//****************************************************************
+// check_water_vertices
+bool check_water_vertices(size_t particle_count) {
+    class Load : public TrivialPartawn {
+    public:
+        Load(TeamTag team_tag) : TrivialPartawn(team_tag) {}
+
+        Vector constraint_velocity(const Vector&) { return Vector(0, 0); }
+        Vector move(const Vector&) { return Vector(0, 0); }
+        void update(float) {}
+    };
+
+    // FqƂɕς悤Ƀ`[lifeU炷
+    std::vector<Load> loads;
+    loads.reserve(particle_count);
+    for (size_t i = 0 ; i < particle_count ; i++) {
+        loads.push_back(Load(i % 3 == 0 ? TeamTag::Beta : TeamTag::Alpha));
+        loads.back().life(float(i % 256) / 255.0f);
+    }
+
+    sph::sph<WaterTraits> sph;
+    sph.initialize(
+        SEARCH_RADIUS,
+        VISCOSITY,
+        DUMPING,
+        Vector(0, GRAVITY),
+        IDEAL_DENSITY,
+        PRESSURE_BALANCE_COEFFICIENT,
+        PRESSURE_REPULSIVE_COEFFICIENT);
+    for (size_t i = 0 ; i < particle_count ; i++) {
+        Vector v(float(i % 509) * 2.0f, float(i / 509) * 2.0f);
+        sph.add_particle(v, 1.0f, &loads[i]);
+    }
+
+    return check_vertices<1>(sph) && check_vertices<6>(sph);
+}
+
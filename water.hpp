@@ -12,6 +12,8 @@
 
 #include "zw/d3dfvf.hpp"
 #include <boost/ref.hpp>
+#include <memory>
+#include <unordered_map>
 #include "sph.hpp"
 #include "vector.hpp"
 #include "team_tag.hpp"
@@ -27,6 +29,39 @@ const float IDEAL_DENSITY          = 7.0f; // 10.0f;
 const float PRESSURE_BALANCE_COEFFICIENT   = 0.0f;
 const float PRESSURE_REPULSIVE_COEFFICIENT = 5.0f;
 
+// STEP_ADAPTIVÊƂdťߕ
+// 1XebvœʂTaCFL_FACTOR{Ɏ܂悤ɂ
+const float CFL_FACTOR             = 0.025f;
+const int   MAX_FRAMES_PER_STEP    = 4;	// ÂȂƂdtDT̂̔{܂ŉ΂
+const int   MAX_SUBSTEPS           = 4;	// Ƃ͂̉񐔂܂ŕ
+
+// multi-rate
+// 2^levelt[̈ړʂTaTIME_LEVEL_DISPLACEMENT{Ɏ܂
+// q2^levelt[1񂾂i߂(levelMAX_TIME_LEVEL܂)
+const int   MAX_TIME_LEVEL         = 3;
+const float TIME_LEVEL_DISPLACEMENT = 0.02f;
+
+// SOLVER_PBF̂Ƃ
+// double densityŌł܂Ƃ̖x(St)ɍ킹Ă
+const float PBF_REST_DENSITY       = 3.5f;
+const int   PBF_ITERATIONS         = 2;
+const float PBF_RELAXATION         = 1.0f;
+
+// LOD
+// ߂ɓGȂĎ~܂Ă(multi-ratelevelő)`[̗q
+// LOD_MERGE_SIZElƂ1̏dqɂ܂Ƃ߂
+// LOD_ENEMY_DISTANCElׂ̗܂œGAo猳ɖ߂
+const int   LOD_INTERVAL           = 16;	// t[1񌩒
+const float LOD_MERGE_SIZE         = 20.0f;
+const float LOD_ENEMY_DISTANCE     = 80.0f;
+const int   LOD_MAX_MEMBERS        = 8;
+const int   LOD_MAX_GROUPS         = 4096;
+
+// hybrid
+// GɐGĂȂq͖x߂cloud̉oœ
+const float CLOUD_REPULSION        = 10.0f;	// ł܂Ƃ̋ߖT̐SPHƑl
+const int   CLOUD_COOLDOWN         = 50;	// G痣ĂSPHœupdate
+
 class IConstraint {
 public:
     virtual ~IConstraint() {}
@@ -34,10 +69,15 @@ public:
     virtual Vector apply(const Vector&) = 0;
 };
 
+class LodPartawn;
+
 class IPartawn {
 public:
     virtual ~IPartawn() {}
 
+    // WaterLODł܂Ƃ߂qȂ炻LodPartawn
+    virtual LodPartawn* as_lod() { return nullptr; }
+
     virtual Vector constraint_velocity(const Vector&) = 0;
     virtual Vector move(const Vector&) = 0;
     virtual Vector location() = 0;
@@ -57,6 +97,10 @@ struct WaterTraits {
     typedef IPartawn* load_type;
     enum { DIMENSION = 2 };
 
+    // GRAVITYPRESSURE_BALANCE_COEFFICIENT0Ȃ̂ŌvZO
+    // (ǂ炩0ȊOɂƂ͂1ɂAsph::initializeassert)
+    enum { USE_GRAVITY = 0, USE_BALANCE_PRESSURE = 0 };
+
     static real_type epsilon() {
         return 1.0e-6f;
     }
@@ -74,7 +118,7 @@ struct WaterTraits {
     }
 
     static int coord(real_type n) {
-        return int(floor(n));
+        return neighbor_search_coord(n);
     }
     static void make_coords(int a[2], const vector_type& v) {
         a[0] = coord(v.x);
@@ -84,13 +128,6 @@ struct WaterTraits {
         v.x = a[0];
         v.y = a[1];
     }
-    static int hash(const int a[2], int table_size) {
-        // large prime numbers
-        const int p1 = 73856093;
-        const int p2 = 19349663;
-
-        return size_t((a[0] * p1)^(a[1] * p2))% table_size;
-    }
     static Vector constraint_velocity(
         const load_type& load, const vector_type& v) {
         if (load == nullptr) { return v; }
@@ -100,17 +137,40 @@ struct WaterTraits {
         if (load == nullptr) { return p; }
         return load->move(p);
     }
+    // Ⴄ`[̗qGĂƂmulti-rateŎ~߂Ȃ
+    // (hybridłSPHœ)
+    static int group(const load_type& load) {
+        if (load == nullptr) { return -1; }
+        return int(load->team_tag());
+    }
 
 };
 
 
 class Water {
+public:
+    // q̕`
+    enum RenderMode {
+        RENDER_QUADS,           // qƂɎOp`2(6_)
+        RENDER_POINT_SPRITES,   // qƂɃ|CgXvCg1_
+    };
+
+    // updatełdťߕ
+    enum StepMode {
+        STEP_FIXED,             // 1t[DT1
+        STEP_ADAPTIVE,          // ő呬xCFLŌ߂
+    };
+
 public:
     Water();
-    ~Water() {}
+    ~Water();
 
     void add(const Vector& v, float mass, IPartawn* partawn);
 
+    // Ȃq(ImmovablePartawnp)
+    // uƂɈxconstraintʂ
+    void add_static(const Vector& v, float mass, IPartawn* partawn);
+
     void render(LPDIRECT3DDEVICE9 device);
 
     void click(Vector& p) {}
@@ -125,10 +185,76 @@ public:
 
     void  set_constraint(IConstraint* constraint);
 
+    // q͈̂(qȂfalse)
+    bool  get_bounds(Vector& minp, Vector& maxp);
+
+    void  set_render_mode(RenderMode m) { render_mode_ = m; }
+    RenderMode get_render_mode() { return render_mode_; }
+
+    void  set_solver(sph::sph<WaterTraits>::Solver s) { sph_.set_solver(s); }
+    sph::sph<WaterTraits>::Solver get_solver() { return sph_.get_solver(); }
+
+    void  set_step_mode(StepMode m) { step_mode_ = m; pending_frames_ = 0; }
+    StepMode get_step_mode() { return step_mode_; }
+
+    // multi-rate(0őSq𖈉i߂AMAX_TIME_LEVEL܂)
+    void  set_max_time_level(int level) {
+        sph_.set_time_levels(level, TIME_LEVEL_DISPLACEMENT);
+    }
+    int   get_max_time_level() { return sph_.get_max_time_level(); }
+
+    // OupdateŐi߂XebvƂdt
+    // (STEP_ADAPTIVEŎ̃t[܂ő҂Ƃ0)
+    int   get_step_count() { return step_count_; }
+    float get_step_dt() { return step_dt_; }
+
+    // LOD(͎gȂABoardLɂȂ)
+    // multi-ratelevelŎ~܂Ă邩̂ŁA
+    // get_max_time_level0̊Ԃ͂܂Ƃ߂Ȃ(܂Ƃ߂͖̂߂)
+    void  set_lod(bool enable);
+    bool  get_lod() { return lod_; }
+    // ܂Ƃ߂ďdq̒ɂ闱q̐
+    size_t merged_particle_count() { return merged_count_; }
+
+    // hybrid(͎gȂ)
+    void  set_hybrid(bool enable) {
+        sph_.set_hybrid(enable, CLOUD_REPULSION, CLOUD_COOLDOWN);
+    }
+    bool  get_hybrid() { return sph_.get_hybrid(); }
+    size_t cloud_particle_count() { return sph_.cloud_particle_count(); }
+
+private:
+    void advance();
+    void step(float dt);
+    void discard_dead();
+    LodPartawn* as_lod(IPartawn* load);
+    bool enemy_near(const Vector& v, TeamTag team_tag);
+    void update_lod();
+    void split_lod(bool all);
+    void merge_lod();
+    void free_lod(LodPartawn* g);
+
 private:
+    typedef zw::fvf::vertex<D3DFVF_XYZRHW|D3DFVF_DIFFUSE> vertex_type;
+
     sph::sph<WaterTraits> sph_;
     IConstraint*     constraint_;
 
+    RenderMode                  render_mode_;
+    std::vector<vertex_type>    vertices_;  // t[蒼͎̈g
+
+    StepMode    step_mode_;
+    int         pending_frames_;    // ܂i߂ĂȂt[
+    int         step_count_;
+    float       step_dt_;
+
+    bool                            lod_;
+    int                             lod_clock_;
+    size_t                          merged_count_;
+    std::unique_ptr<LodPartawn[]>   lod_pool_;  // qloadŵœȂ
+    std::vector<int>                lod_free_;
+    std::unordered_map<boost::uint64_t, unsigned int> lod_teams_; // Z -> `[
+
 };
 
 class TrivialPartawn : public IPartawn {
@@ -168,4 +294,8 @@ public:
 
 };
 
+// _Xbh2..8ɕʂ1XbĥƂƓ
+// (|CgXvCgƎlp`̗Aparticle_count̗qŒׂ)
+bool check_water_vertices(size_t particle_count);
+
 #endif // WATER_HPP_